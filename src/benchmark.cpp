@@ -12,11 +12,29 @@
 #include <algorithm>
 #include <benchmark/benchmark.h>
 #include <chrono>
+#include <cstring>
+#include <deque>
+#include <ctime>
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <numeric>
 #include <random>
+#include <thread>
+#include <vector>
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "parallel/parallel_reduce.hpp"
+#include "parallel/parallel_scan.hpp"
+#include "parallel/sample_sort.hpp"
+#include "parallel/stencil.hpp"
 #include "scheduler_instance.hpp"
 #include "tests/fib.hpp"
 #include "tests/heat.hpp"
@@ -57,6 +75,74 @@ void assertTrue(bool condition, const std::string &message) {
   }
 }
 
+// CPU time used by all threads of the process so far, in seconds. Compared
+// against wall time this shows how much CPU the workers burn while waiting.
+double processCpuSeconds() {
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+// Hardware events a HardwareCounter can count
+enum HardwareEvent { EVENT_CACHE_MISSES, EVENT_DTLB_MISSES };
+
+// Counts an event (by default last level cache misses) of the calling thread
+// and of every thread it creates while the counter is open. Counts from a
+// thread are only added once it exits, so read() after the pool is joined.
+// Reads -1 where hardware counters aren't available (not Linux, or perf
+// events are restricted).
+class HardwareCounter {
+private:
+  int fd = -1;
+
+public:
+  HardwareCounter(HardwareEvent event = EVENT_CACHE_MISSES) {
+#ifdef __linux__
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    if (event == EVENT_DTLB_MISSES) {
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    } else {
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    }
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  ~HardwareCounter() {
+#ifdef __linux__
+    if (fd >= 0) {
+      close(fd);
+    }
+#endif
+  }
+
+  long long read() {
+#ifdef __linux__
+    long long count;
+    if (fd >= 0 && ::read(fd, &count, sizeof(count)) == sizeof(count)) {
+      return count;
+    }
+#endif
+    return -1;
+  }
+};
+
+// Returns the pth percentile (0 <= p <= 1) of samples. Sorts samples.
+double percentile(std::vector<double> &samples, double p) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t index = static_cast<size_t>(p * (samples.size() - 1));
+  return samples[index];
+}
+
 // Initialization functions that run at the beginning of each test.
 // We set the global scheduler used in all tests to a specific scheduler
 // we want to test.
@@ -84,16 +170,22 @@ static void BM_Quicksort(benchmark::State &state) {
     elem = dist(gen); // Fill the array with random integers
   }
   std::vector<int> copy(arr);
+  double cpuSeconds = 0.0;
 
   for (auto _ : state) {
+    double cpuStart = processCpuSeconds();
     scheduler->run(
         [&arr] { return quicksort(arr.data(), arr.data() + arr.size()); },
         NUM_THREADS);
+    cpuSeconds += processCpuSeconds() - cpuStart;
     state.PauseTiming();
     assertTrue(isSorted(arr), "Quicksort");
     arr = copy;
     state.ResumeTiming();
   }
+
+  state.counters["ProcessCPU"] =
+      benchmark::Counter(cpuSeconds, benchmark::Counter::kAvgIterations);
 }
 
 // Benchmark fibonacci. We test the inefficient O(2^n) recursive
@@ -108,16 +200,55 @@ static void BM_Fib(benchmark::State &state) {
   }
 }
 
+// Benchmark counting the solutions of the n queens problem
 static void BM_NQueens(benchmark::State &state) {
+  // Known solution counts for n = 0, 1, ..., 18
+  const long long expected[] = {1,       1,        0,         0,        2,
+                                10,      4,        40,        92,       352,
+                                724,     2680,     14200,     73712,    365596,
+                                2279184, 14772512, 95815104,  666090624};
+  int n = state.range(0);
+  for (auto _ : state) {
+    long long count;
+    scheduler->run(
+        [n, &count] {
+          count = nqueens(n);
+          return 0;
+        },
+        NUM_THREADS);
+    state.PauseTiming();
+    assertTrue(count == expected[n], "N-Queens");
+    state.ResumeTiming();
+  }
+}
+
+// Benchmark finding a single n queens solution (n = state.range(0)). With
+// state.range(1) == 1 the first solution cancels the rest of the search.
+// With 0 every parallel branch runs until it finds its own solution or
+// exhausts its subtree.
+static void BM_NQueensFirst(benchmark::State &state) {
   int n = state.range(0);
-  char *a = new char[n];
-  char *copy = new char[n];
-  std::copy(a, a + n, copy);
+  bool cancel = state.range(1);
   for (auto _ : state) {
-    scheduler->run([n, a] { return nqueens(n, 0, a); }, NUM_THREADS);
-    a = copy;
+    std::vector<int> queens;
+    bool found;
+    scheduler->run(
+        [&] {
+          found = nqueensFirst(n, queens, cancel);
+          return 0;
+        },
+        NUM_THREADS);
+    state.PauseTiming();
+    bool valid = found && (int)queens.size() == n;
+    for (int i = 0; valid && i < n; i++) {
+      for (int j = i + 1; j < n; j++) {
+        valid = valid && queens[i] != queens[j] &&
+                std::abs(queens[i] - queens[j]) != j - i;
+      }
+    }
+    assertTrue(valid, "N-Queens First");
+    state.ResumeTiming();
   }
-  delete[] a;
 }
 
 static void BM_Rectmul(benchmark::State &state) {
@@ -127,6 +258,136 @@ static void BM_Rectmul(benchmark::State &state) {
   }
 }
 
+// Clock rate of the first core in GHz as the kernel reports it, or -1 if
+// unknown. With turbo the cores may run faster than this.
+double cpuGHz() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.rfind("cpu MHz", 0) == 0) {
+      return std::stod(line.substr(line.find(':') + 1)) / 1000;
+    }
+  }
+  return -1;
+}
+
+// Benchmark rectmul of 512 x 512 matrices with one block kernel
+// (state.range(0) is a RectmulKernel) on state.range(1) threads. Reports
+// GFLOP/s per core and the fraction of the cores' peak that is (-1 if the
+// clock rate is unknown).
+static void BM_RectmulKernel(benchmark::State &state) {
+  RectmulKernel kernel = (RectmulKernel)state.range(0);
+  int threads = state.range(1);
+  if (!rectmulKernelSupported(kernel)) {
+    state.SkipWithError("Kernel not supported by this CPU");
+    return;
+  }
+
+  const long blocks = 32;
+  for (auto _ : state) {
+    scheduler->run([kernel] { return rectmul(blocks, blocks, blocks, kernel); },
+                   threads);
+  }
+
+  double n = 16.0 * blocks;
+  int cores = std::min<int>(threads, std::thread::hardware_concurrency());
+  state.counters["GFLOPsPerCore"] = benchmark::Counter(
+      2 * n * n * n / 1e9 / cores,
+      benchmark::Counter::kIsIterationInvariantRate);
+  double ghz = cpuGHz();
+  double peak = ghz * rectmulKernelPeakFlopsPerCycle(kernel);
+  state.counters["PeakFraction"] = benchmark::Counter(
+      ghz < 0 ? -1 : 2 * n * n * n / 1e9 / cores / peak,
+      benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Benchmark a tall-skinny product (32 x 8192 times 8192 x 32) that can only
+// be split along y, with a budget for temporaries of state.range(0) MB. With
+// no budget the halves of every y split run one after the other.
+static void BM_RectmulSplitY(benchmark::State &state) {
+  long long budget = state.range(0) << 20;
+  for (auto _ : state) {
+    scheduler->run(
+        [budget] { return rectmul(2, 512, 2, KERNEL_AUTO, budget); },
+        NUM_THREADS);
+  }
+}
+
+// Benchmark rectmul of square matrices of state.range(0) blocks per side
+// with row major (state.range(1) == 0) or Z-order (1) block storage. Reports
+// last level cache and data TLB misses per iteration (-1 if hardware
+// counters are unavailable).
+static void BM_RectmulLayout(benchmark::State &state) {
+  long blocks = state.range(0);
+  RectmulLayout layout = (RectmulLayout)state.range(1);
+  long long cacheMisses = 0;
+  long long tlbMisses = 0;
+  for (auto _ : state) {
+    HardwareCounter cache(EVENT_CACHE_MISSES);
+    HardwareCounter tlb(EVENT_DTLB_MISSES);
+    scheduler->run(
+        [blocks, layout] {
+          return rectmul(blocks, blocks, blocks, KERNEL_AUTO, 0, layout);
+        },
+        NUM_THREADS);
+    cacheMisses += cache.read();
+    tlbMisses += tlb.read();
+  }
+  state.counters["CacheMisses"] =
+      benchmark::Counter(cacheMisses, benchmark::Counter::kAvgIterations);
+  state.counters["TLBMisses"] =
+      benchmark::Counter(tlbMisses, benchmark::Counter::kAvgIterations);
+}
+
+// Benchmark square products of state.range(0) blocks per side with
+// Strassen-Winograd down to state.range(1) blocks per side (0 for the
+// classical product, -1 to autotune the crossover first). Reports the
+// crossover used and the error against the classical product.
+static void BM_RectmulStrassen(benchmark::State &state) {
+  long blocks = state.range(0);
+  long crossover = state.range(1);
+  if (crossover < 0) {
+    crossover = scheduler->run(
+        [blocks] { return (int)rectmulTuneCrossover(blocks); }, NUM_THREADS);
+  }
+  double error = 0.0;
+  if (crossover > 0) {
+    scheduler->run(
+        [&] {
+          error = rectmulStrassenError(blocks, crossover);
+          return 0;
+        },
+        NUM_THREADS);
+  }
+  for (auto _ : state) {
+    scheduler->run(
+        [blocks, crossover] {
+          return rectmul(blocks, blocks, blocks, KERNEL_AUTO, 0,
+                         LAYOUT_MORTON, crossover);
+        },
+        NUM_THREADS);
+  }
+  state.counters["Crossover"] = crossover;
+  state.counters["RelativeError"] = error;
+}
+
+// Benchmark rectmul of two state.range(0) x state.range(0) matrices of T in
+// EDGE x EDGE blocks. Sizes that aren't a multiple of EDGE are padded.
+template <typename T, int EDGE>
+static void BM_RectmulTyped(benchmark::State &state) {
+  long n = state.range(0);
+  int errors = 0;
+  for (auto _ : state) {
+    errors = scheduler->run(
+        [n] { return rectmulTyped<T, EDGE>(n, n, n); }, NUM_THREADS);
+  }
+  if (errors != 0) {
+    state.SkipWithError("Wrong product");
+  }
+  state.counters["GFLOPs"] = benchmark::Counter(
+      2.0 * n * n * n / 1e9, benchmark::Counter::kIsIterationInvariantRate);
+}
+
 static void BM_PFor(benchmark::State &state) {
   int x = state.range(0);
   for (auto _ : state) {
@@ -172,13 +433,13 @@ static void BM_NBody(benchmark::State &state) {
   }
 }
 
+// Benchmark heat on a 16384 x 4096 grid for state.range(0) timesteps.
+// Reports the time per timestep and the bandwidth of reading one grid and
+// writing the other once per timestep.
 static void BM_Heat(benchmark::State &state) {
-  int n = state.range(0);
-  std::vector<Particle> particles;
-
   int nx = 16384;
   int ny = 4096;
-  int nt = 400;
+  int nt = state.range(0);
   double xu = 0.0;
   double xo = 1.570796326794896558;
   double yu = 0.0;
@@ -186,14 +447,782 @@ static void BM_Heat(benchmark::State &state) {
   double tu = 0.0;
   double to = 0.0000001;
   int leafmaxcol = 1;
+  double cpuSeconds = 0.0;
 
   // Run the simulation for benchmarking
   for (auto _ : state) {
-    // Run the n-body simulation
+    double cpuStart = processCpuSeconds();
     scheduler->run(
         [=] { return heat(nx, ny, nt, xu, xo, yu, yo, tu, to, leafmaxcol); },
         NUM_THREADS);
+    cpuSeconds += processCpuSeconds() - cpuStart;
+  }
+
+  state.counters["ProcessCPU"] =
+      benchmark::Counter(cpuSeconds, benchmark::Counter::kAvgIterations);
+  state.counters["TimePerStep"] = benchmark::Counter(
+      nt, benchmark::Counter::kIsIterationInvariantRate |
+              benchmark::Counter::kInvert);
+  state.counters["GBps"] = benchmark::Counter(
+      2.0 * nx * ny * sizeof(double) * nt / 1e9,
+      benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Whether heat walked in mode gives bitwise the same grid as a sweep, on a
+// grid small enough to check quickly and large enough to be cut in both
+// space and time
+static bool heatMatchesSweep(HeatMode mode) {
+  int nx = 301, ny = 257, nt = 37;
+  HeatSolver sweep(nx, ny, nt, 0.0, 1.570796326794896558, 0.0,
+                   1.570796326794896558, 0.0, 0.0000001, 4);
+  HeatSolver other(nx, ny, nt, 0.0, 1.570796326794896558, 0.0,
+                   1.570796326794896558, 0.0, 0.0000001, 4, false,
+                   SCHEDULE_LAZY, mode);
+  scheduler->run(
+      [&] {
+        sweep.run();
+        return other.run();
+      },
+      NUM_THREADS);
+
+  for (int a = 0; a < nx; a++) {
+    for (int b = 0; b < ny; b++) {
+      double x = sweep.at(a, b), y = other.at(a, b);
+      if (memcmp(&x, &y, sizeof(double)) != 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Benchmark heat on a 16384 x 4096 grid, 1 GB for both grids, for
+// state.range(1) timesteps, sweeping the grid once per timestep
+// (state.range(0) == HEAT_SWEEP) or in trapezoids (HEAT_TRAPEZOID). Reports
+// last level cache misses per timestep and the DRAM traffic they amount to
+// (-1 if hardware counters are unavailable). Checks that the result is
+// bitwise the same as sweeping.
+static void BM_HeatTrapezoid(benchmark::State &state) {
+  HeatMode mode = static_cast<HeatMode>(state.range(0));
+  int nt = state.range(1);
+  long long misses = 0;
+
+  for (auto _ : state) {
+    HardwareCounter counter;
+    scheduler->run(
+        [=] {
+          return heat(16384, 4096, nt, 0.0, 1.570796326794896558, 0.0,
+                      1.570796326794896558, 0.0, 0.0000001, 1, false,
+                      SCHEDULE_LAZY, mode);
+        },
+        NUM_THREADS);
+    long long count = counter.read();
+    misses = (misses < 0 || count < 0) ? -1 : misses + count;
+  }
+
+  assertTrue(heatMatchesSweep(mode), "Heat Trapezoid");
+
+  double perStep = misses < 0 ? -1 : static_cast<double>(misses) / nt;
+  state.counters["LLCMissesPerStep"] =
+      benchmark::Counter(perStep, benchmark::Counter::kAvgIterations);
+  state.counters["DRAMBytesPerStep"] = benchmark::Counter(
+      misses < 0 ? -1 : perStep * 64, benchmark::Counter::kAvgIterations);
+  state.counters["TimePerStep"] = benchmark::Counter(
+      nt, benchmark::Counter::kIsIterationInvariantRate |
+              benchmark::Counter::kInvert);
+}
+
+// Benchmark state.range(0) independent 2048 x 1024 heat simulations of 50
+// timesteps running at once in one pool. The solvers keep their grids across
+// iterations. Reports simulations per second.
+static void BM_HeatConcurrent(benchmark::State &state) {
+  int k = state.range(0);
+  std::vector<std::unique_ptr<HeatSolver>> solvers;
+  for (int i = 0; i < k; i++) {
+    solvers.emplace_back(new HeatSolver(2048, 1024, 50, 0.0,
+                                        1.570796326794896558, 0.0,
+                                        1.570796326794896558, 0.0, 0.0000001,
+                                        8));
+  }
+
+  for (auto _ : state) {
+    scheduler->run(
+        [&solvers] {
+          std::vector<std::future<int>> runs;
+          for (auto &solver : solvers) {
+            HeatSolver *s = solver.get();
+            runs.push_back(scheduler->spawn([s] { return s->run(); }));
+          }
+          for (auto &run : runs) {
+            scheduler->sync(std::move(run));
+          }
+          return 0;
+        },
+        NUM_THREADS);
+  }
+
+  state.counters["Simulations"] =
+      benchmark::Counter(k, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Benchmark 50 timesteps of heat on a 4096 x 1024 grid in stripes of 8
+// rows, swept with a barrier per timestep (state.range(0) == HEAT_SWEEP) or
+// as a dataflow graph of stripes (HEAT_DATAFLOW). Reports the time workers
+// sat idle during the timesteps, i.e. weren't computing stripes, per
+// timestep and as a fraction of the pool's time. Workers beyond the number
+// of cores don't add to the pool's time. Checks that the result is bitwise
+// the same as sweeping.
+static void BM_HeatDataflow(benchmark::State &state) {
+  HeatMode mode = static_cast<HeatMode>(state.range(0));
+  int nt = 50;
+  HeatSolver solver(4096, 1024, nt, 0.0, 1.570796326794896558, 0.0,
+                    1.570796326794896558, 0.0, 0.0000001, 8, false,
+                    SCHEDULE_LAZY, mode);
+  solver.timeStripes();
+  int cores = std::min<int>(NUM_THREADS, std::thread::hardware_concurrency());
+  double idle = 0.0, pool = 0.0;
+
+  for (auto _ : state) {
+    scheduler->run([&solver] { return solver.run(); }, NUM_THREADS);
+    pool += solver.stepSeconds() * cores;
+    idle += solver.stepSeconds() * cores - solver.busySeconds();
+  }
+
+  assertTrue(heatMatchesSweep(mode), "Heat Dataflow");
+
+  state.counters["IdlePerStep"] =
+      benchmark::Counter(idle / nt, benchmark::Counter::kAvgIterations);
+  state.counters["IdleFraction"] = idle / pool;
+}
+
+// Edges held at 0 for the stencil benchmarks
+template <int D> struct ZeroBoundary {
+  double operator()(const std::array<long, D> &, int) const { return 0.0; }
+};
+
+// Whether kernel walked in mode gives bitwise the same grid as a sweep, for
+// 37 timesteps on a small grid of the given extents
+template <int D, typename Kernel>
+static bool stencilMatchesSweep(StencilMode mode,
+                                const std::array<long, D> &extents,
+                                Kernel kernel) {
+  typedef Stencil<double, D, Kernel, ZeroBoundary<D>> Grid;
+  StencilOptions options;
+  options.tile = 4;
+  Grid sweep(extents, kernel, ZeroBoundary<D>(), options);
+  options.mode = mode;
+  Grid other(extents, kernel, ZeroBoundary<D>(), options);
+  auto init = [](const std::array<long, D> &i) {
+    return ((i[0] * 7 + i[D - 1] * 3) % 11) * 0.1;
+  };
+  scheduler->run(
+      [&] {
+        sweep.init(init);
+        sweep.run(37);
+        other.init(init);
+        other.run(37);
+        return 0;
+      },
+      NUM_THREADS);
+
+  long points = 1;
+  for (long e : extents) {
+    points *= e;
+  }
+  std::array<long, D> i;
+  for (long p = 0; p < points; p++) {
+    long rest = p;
+    for (int d = D - 1; d >= 0; d--) {
+      i[d] = rest % extents[d];
+      rest /= extents[d];
+    }
+    double x = sweep.grid()[i], y = other.grid()[i];
+    if (memcmp(&x, &y, sizeof(double)) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Run state.range(1) timesteps of kernel on a grid of the given extents,
+// swept (state.range(0) == STENCIL_SWEEP) or in trapezoids
+// (STENCIL_TRAPEZOID). Reports points updated per second. Checks on a small
+// grid of the same dimension that the result is bitwise the same as
+// sweeping.
+template <int D, typename Kernel>
+static void runStencil(benchmark::State &state,
+                       const std::array<long, D> &extents,
+                       const std::array<long, D> &checkExtents,
+                       Kernel kernel) {
+  StencilOptions options;
+  options.tile = 8;
+  options.mode = static_cast<StencilMode>(state.range(0));
+  int steps = state.range(1);
+  Stencil<double, D, Kernel, ZeroBoundary<D>> stencil(
+      extents, kernel, ZeroBoundary<D>(), options);
+
+  for (auto _ : state) {
+    scheduler->run(
+        [&] {
+          stencil.init([](const std::array<long, D> &) { return 1.0; });
+          stencil.run(steps);
+          return 0;
+        },
+        NUM_THREADS);
+  }
+
+  assertTrue(stencilMatchesSweep<D>(options.mode, checkExtents, kernel),
+             "Stencil");
+
+  long points = 1;
+  for (long e : extents) {
+    points *= e;
+  }
+  state.counters["Points"] = benchmark::Counter(
+      static_cast<double>(points) * steps,
+      benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Benchmark a 9 point stencil on a 4096 x 4096 grid
+static void BM_Stencil2D(benchmark::State &state) {
+  runStencil<2>(state, {4096, 4096}, {301, 257},
+                NinePoint2D<double>{0.5, 0.1, 0.025});
+}
+
+// Benchmark a 7 point stencil on a 256 x 256 x 256 grid
+static void BM_Stencil3D(benchmark::State &state) {
+  runStencil<3>(state, {256, 256, 256}, {67, 41, 37},
+                SevenPoint3D<double>{0.4, 0.1});
+}
+
+// Benchmark a service-style workload: several producer threads outside the
+// pool each submit a small independent root every 250us (4000 roots per
+// second per producer). Reports the latency from submit to completion.
+static void BM_SubmitLatency(benchmark::State &state) {
+  int producers = state.range(0);
+  int rootsPerProducer = state.range(1);
+  const auto interval = std::chrono::microseconds(250);
+  std::vector<double> latencies;
+
+  childSchedulerLF.start(NUM_THREADS);
+  for (auto _ : state) {
+    std::vector<std::vector<double>> producerLatencies(producers);
+    std::vector<std::thread> producerThreads;
+
+    for (int p = 0; p < producers; p++) {
+      producerThreads.emplace_back([&, p] {
+        std::vector<double> &lat = producerLatencies[p];
+        lat.resize(rootsPerProducer);
+        std::vector<std::future<int>> futures;
+        auto next = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < rootsPerProducer; i++) {
+          auto submitted = std::chrono::steady_clock::now();
+          futures.push_back(childSchedulerLF.submit([submitted, &lat, i] {
+            int res = fibSeq(15);
+            lat[i] = std::chrono::duration<double, std::micro>(
+                         std::chrono::steady_clock::now() - submitted)
+                         .count();
+            return res;
+          }));
+          next += interval;
+          std::this_thread::sleep_until(next);
+        }
+
+        for (auto &fut : futures) {
+          assertTrue(fut.get() == fibSeq(15), "Submit");
+        }
+      });
+    }
+
+    for (auto &t : producerThreads) {
+      t.join();
+    }
+    for (auto &lat : producerLatencies) {
+      latencies.insert(latencies.end(), lat.begin(), lat.end());
+    }
+  }
+  childSchedulerLF.stop();
+
+  state.counters["Roots"] = benchmark::Counter(
+      static_cast<double>(latencies.size()), benchmark::Counter::kIsRate);
+  state.counters["p50_us"] = percentile(latencies, 0.50);
+  state.counters["p99_us"] = percentile(latencies, 0.99);
+}
+
+// Benchmark a latency sensitive tenant sharing a pool with a heavy rectmul
+// tenant that always has two jobs in flight. The small tenant submits a tiny
+// root every millisecond. With isolation (Arg 1) each tenant gets its own
+// arena: the bulk arena is capped two workers below the pool size and the
+// small arena has four times its weight. Without isolation (Arg 0) both
+// tenants share the default arena.
+static void BM_Arenas(benchmark::State &state) {
+  bool isolated = state.range(0);
+  const int smallJobs = 500;
+  const auto interval = std::chrono::milliseconds(1);
+  std::vector<double> latencies;
+
+  // Use a fresh pool so arenas from other runs don't pile up. Workloads spawn
+  // through the global scheduler, so point it at the pool meanwhile.
+  ArenaScheduler<int> pool;
+  Scheduler<int> *prevScheduler = scheduler;
+  scheduler = &pool;
+  auto *bulk = isolated ? pool.createArena(NUM_THREADS - 2, 1)
+                        : pool.defaultArena();
+  auto *small = isolated ? pool.createArena(NUM_THREADS, 4)
+                         : pool.defaultArena();
+  pool.start(NUM_THREADS);
+
+  for (auto _ : state) {
+    std::atomic<bool> done = false;
+    std::thread bulkThread([&] {
+      while (!done) {
+        auto job1 = pool.submit(bulk, [] { return rectmul(16, 16, 16); });
+        auto job2 = pool.submit(bulk, [] { return rectmul(16, 16, 16); });
+        job1.get();
+        job2.get();
+      }
+    });
+
+    std::vector<double> lat(smallJobs);
+    std::vector<std::future<int>> futures;
+    auto next = std::chrono::steady_clock::now();
+    for (int i = 0; i < smallJobs; i++) {
+      auto submitted = std::chrono::steady_clock::now();
+      futures.push_back(pool.submit(small, [submitted, &lat, i] {
+        int res = fibSeq(15);
+        lat[i] = std::chrono::duration<double, std::micro>(
+                     std::chrono::steady_clock::now() - submitted)
+                     .count();
+        return res;
+      }));
+      next += interval;
+      std::this_thread::sleep_until(next);
+    }
+    for (auto &fut : futures) {
+      fut.get();
+    }
+
+    done = true;
+    bulkThread.join();
+    latencies.insert(latencies.end(), lat.begin(), lat.end());
+  }
+
+  pool.stop();
+  scheduler = prevScheduler;
+
+  // Per-arena numbers as recorded by the scheduler
+  auto report = [&state](const std::string &name,
+                         ArenaScheduler<int>::ArenaStats stats) {
+    state.counters[name + "_roots"] = benchmark::Counter(
+        static_cast<double>(stats.rootsCompleted), benchmark::Counter::kIsRate);
+    state.counters[name + "_mean_us"] = stats.meanLatencyUs;
+  };
+  if (isolated) {
+    report("bulk", pool.stats(bulk));
+    report("small", pool.stats(small));
+  } else {
+    report("shared", pool.stats(pool.defaultArena()));
+  }
+  state.counters["small_p50_us"] = percentile(latencies, 0.50);
+  state.counters["small_p99_us"] = percentile(latencies, 0.99);
+}
+
+// Benchmark completion time of small jobs while the pool is kept busy with
+// background work. Every background root spawns 64 medium tasks, and
+// NUM_THREADS such roots are always in flight. A small job is submitted every
+// millisecond. With Arg 1 the small jobs run at high priority and the
+// background at low priority. With Arg 0 everything runs at normal priority.
+static void BM_Priority(benchmark::State &state) {
+  bool prioritized = state.range(0);
+  Priority smallPriority = prioritized ? PRIORITY_HIGH : PRIORITY_NORMAL;
+  Priority bulkPriority = prioritized ? PRIORITY_LOW : PRIORITY_NORMAL;
+  const int smallJobs = 300;
+  const auto interval = std::chrono::milliseconds(1);
+  std::vector<double> latencies;
+
+  // Background roots spawn through the global scheduler
+  Scheduler<int> *prevScheduler = scheduler;
+  scheduler = &childSchedulerLF;
+  childSchedulerLF.start(NUM_THREADS);
+
+  for (auto _ : state) {
+    std::atomic<bool> done = false;
+    std::thread bulkThread([&] {
+      auto bulkJob = [] {
+        std::vector<std::future<int>> futures;
+        for (int i = 0; i < 64; i++) {
+          futures.push_back(scheduler->spawn([] { return fibSeq(22); }));
+        }
+        int sum = 0;
+        for (auto &fut : futures) {
+          sum += scheduler->sync(std::move(fut));
+        }
+        return sum;
+      };
+
+      std::deque<std::future<int>> inFlight;
+      while (!done) {
+        while (inFlight.size() < NUM_THREADS) {
+          inFlight.push_back(childSchedulerLF.submit(bulkJob, bulkPriority));
+        }
+        inFlight.front().get();
+        inFlight.pop_front();
+      }
+      for (auto &fut : inFlight) {
+        fut.get();
+      }
+    });
+
+    std::vector<double> lat(smallJobs);
+    std::vector<std::future<int>> futures;
+    auto next = std::chrono::steady_clock::now();
+    for (int i = 0; i < smallJobs; i++) {
+      auto submitted = std::chrono::steady_clock::now();
+      futures.push_back(childSchedulerLF.submit(
+          [submitted, &lat, i] {
+            int res = fibSeq(15);
+            lat[i] = std::chrono::duration<double, std::micro>(
+                         std::chrono::steady_clock::now() - submitted)
+                         .count();
+            return res;
+          },
+          smallPriority));
+      next += interval;
+      std::this_thread::sleep_until(next);
+    }
+    for (auto &fut : futures) {
+      fut.get();
+    }
+
+    done = true;
+    bulkThread.join();
+    latencies.insert(latencies.end(), lat.begin(), lat.end());
+  }
+
+  childSchedulerLF.stop();
+  scheduler = prevScheduler;
+
+  state.counters["p50_us"] = percentile(latencies, 0.50);
+  state.counters["p99_us"] = percentile(latencies, 0.99);
+}
+
+// Benchmark heat with and without affinity hints. With Arg 1 every stripe is
+// mailed to the worker that owns its rows, so across timesteps a worker keeps
+// reading the rows it wrote last time. The grid is larger than the last level
+// cache in total but each worker's share is not. Reports last level cache
+// misses per timestep (-1 if hardware counters are unavailable).
+static void BM_HeatAffinity(benchmark::State &state) {
+  bool affinity = state.range(0);
+  int nx = 4096;
+  int ny = 1024;
+  int nt = state.range(1);
+  double xu = 0.0;
+  double xo = 1.570796326794896558;
+  double yu = 0.0;
+  double yo = 1.570796326794896558;
+  double tu = 0.0;
+  double to = 0.0000001;
+  int leafmaxcol = 8;
+  long long misses = 0;
+
+  for (auto _ : state) {
+    HardwareCounter counter;
+    scheduler->run(
+        [=] {
+          return heat(nx, ny, nt, xu, xo, yu, yo, tu, to, leafmaxcol,
+                      affinity);
+        },
+        NUM_THREADS);
+    long long count = counter.read();
+    misses = (misses < 0 || count < 0) ? -1 : misses + count;
+  }
+
+  if (misses < 0) {
+    state.counters["LLCMissesPerStep"] = -1;
+  } else {
+    state.counters["LLCMissesPerStep"] =
+        benchmark::Counter(static_cast<double>(misses) / nt,
+                           benchmark::Counter::kAvgIterations);
+  }
+}
+
+// Benchmark the loop schedules (state.range(0) is a LoopSchedule) on nbody,
+// whose loops are uniform. Reports particle pairs per second.
+static void BM_LoopNBody(benchmark::State &state) {
+  LoopSchedule schedule = static_cast<LoopSchedule>(state.range(0));
+  std::vector<Particle> particles;
+  for (int i = 0; i < 2000; ++i) {
+    particles.push_back(Particle(
+        getRandomDouble(-100.0, 100.0), getRandomDouble(-100.0, 100.0),
+        getRandomDouble(-10.0, 10.0), getRandomDouble(-10.0, 10.0),
+        getRandomDouble(1, 1000.0)));
+  }
+  std::vector<Particle> copy(particles);
+
+  for (auto _ : state) {
+    scheduler->run(
+        [&particles, schedule] {
+          simulateNBody(particles, schedule);
+          return 0;
+        },
+        NUM_THREADS);
+    state.PauseTiming();
+    particles = copy;
+    state.ResumeTiming();
+  }
+
+  state.counters["Interactions"] = benchmark::Counter(
+      2000.0 * 1999, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Benchmark a Barnes-Hut timestep of state.range(0) random particles with
+// opening angle state.range(1) / 100. Reports interactions per second and,
+// for up to 5000 particles, the error of the accelerations against summing
+// over all pairs, which is also checked: opening every cell must match the
+// direct sum up to rounding, and angles up to 0.5 must stay within 1%.
+static void BM_NBodyBarnesHut(benchmark::State &state) {
+  int n = state.range(0);
+  double theta = state.range(1) / 100.0;
+  std::vector<Particle> particles;
+  for (int i = 0; i < n; ++i) {
+    particles.push_back(Particle(
+        getRandomDouble(-100.0, 100.0), getRandomDouble(-100.0, 100.0),
+        getRandomDouble(-10.0, 10.0), getRandomDouble(-10.0, 10.0),
+        getRandomDouble(1, 1000.0)));
+  }
+  std::vector<Particle> copy(particles);
+
+  if (n <= 5000) {
+    double error = 0.0, exactError = 0.0;
+    scheduler->run(
+        [&] {
+          error = nbodyBarnesHutError(particles, theta);
+          exactError = nbodyBarnesHutError(particles, 0.0);
+          return 0;
+        },
+        NUM_THREADS);
+    assertTrue(exactError < 1e-12, "Barnes-Hut Exact");
+    if (theta <= 0.5) {
+      assertTrue(error < 1e-2, "Barnes-Hut");
+    }
+    state.counters["RelativeError"] = error;
+  }
+
+  long long interactions = 0;
+  for (auto _ : state) {
+    scheduler->run(
+        [&] {
+          interactions += simulateNBodyBarnesHut(particles, theta);
+          return 0;
+        },
+        NUM_THREADS);
+    state.PauseTiming();
+    particles = copy;
+    state.ResumeTiming();
+  }
+
+  state.counters["Interactions"] = benchmark::Counter(
+      interactions, benchmark::Counter::kIsRate);
+}
+
+// Benchmark the loop schedules (state.range(0) is a LoopSchedule) on heat's
+// stripes, one loop per timestep.
+static void BM_LoopHeat(benchmark::State &state) {
+  LoopSchedule schedule = static_cast<LoopSchedule>(state.range(0));
+  for (auto _ : state) {
+    scheduler->run(
+        [schedule] {
+          return heat(4096, 1024, 50, 0.0, 1.570796326794896558, 0.0,
+                      1.570796326794896558, 0.0, 0.0000001, 8, false,
+                      schedule);
+        },
+        NUM_THREADS);
+  }
+}
+
+// Random small ints, so sums of up to 10^9 of them fit in a long long
+std::vector<int> randomInts(size_t n) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dist(0, 1000);
+  std::vector<int> vec(n);
+  for (auto &elem : vec) {
+    elem = dist(gen);
   }
+  return vec;
+}
+
+// Baseline for BM_ParallelReduce: serial std::accumulate
+static void BM_Accumulate(benchmark::State &state) {
+  std::vector<int> vec = randomInts(state.range(0));
+  for (auto _ : state) {
+    long long sum = std::accumulate(vec.begin(), vec.end(), 0LL);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_ParallelReduce(benchmark::State &state) {
+  std::vector<int> vec = randomInts(state.range(0));
+  long long expected = std::accumulate(vec.begin(), vec.end(), 0LL);
+  for (auto _ : state) {
+    long long sum = 0;
+    scheduler->run(
+        [&] {
+          sum = parallel_reduce(vec.begin(), vec.end(), 0LL,
+                                [](long long a, long long b) { return a + b; });
+          return 0;
+        },
+        NUM_THREADS);
+    assertTrue(sum == expected, "parallel_reduce");
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Baseline for BM_ParallelScan: serial in place std::inclusive_scan
+static void BM_InclusiveScan(benchmark::State &state) {
+  std::vector<int> input = randomInts(state.range(0));
+  std::vector<long long> vec(input.begin(), input.end());
+  for (auto _ : state) {
+    std::inclusive_scan(vec.begin(), vec.end(), vec.begin());
+    benchmark::DoNotOptimize(vec.data());
+    state.PauseTiming();
+    std::copy(input.begin(), input.end(), vec.begin());
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_ParallelScan(benchmark::State &state) {
+  std::vector<int> input = randomInts(state.range(0));
+  std::vector<long long> expected(input.size());
+  std::inclusive_scan(input.begin(), input.end(), expected.begin(), std::plus<>(),
+                      0LL);
+  std::vector<long long> vec(input.begin(), input.end());
+  for (auto _ : state) {
+    scheduler->run(
+        [&] {
+          parallel_inclusive_scan(vec.begin(), vec.end(), vec.begin(), 0LL,
+                                  std::plus<>());
+          return 0;
+        },
+        NUM_THREADS);
+    state.PauseTiming();
+    assertTrue(vec == expected, "parallel_inclusive_scan");
+    std::copy(input.begin(), input.end(), vec.begin());
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Benchmark quicksort at different pool sizes (state.range(0)), with the top
+// levels partitioned serially (state.range(1) == 0) or in parallel (1). The
+// serial partition of the first level alone bounds the span at O(n).
+// Reports the CPU time used by the process, so CPU / wall time is the
+// parallelism actually achieved. Keys are distinct enough that duplicates
+// don't skew the partitions.
+static void BM_QuicksortThreads(benchmark::State &state) {
+  int threads = state.range(0);
+  bool parallelPartition = state.range(1);
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dist;
+  std::vector<int> arr(5000000);
+  for (auto &elem : arr) {
+    elem = dist(gen);
+  }
+  std::vector<int> copy(arr);
+  double cpuSeconds = 0.0;
+
+  for (auto _ : state) {
+    double cpuStart = processCpuSeconds();
+    scheduler->run(
+        [&arr, parallelPartition] {
+          return quicksort(arr.data(), arr.data() + arr.size(),
+                           parallelPartition);
+        },
+        threads);
+    cpuSeconds += processCpuSeconds() - cpuStart;
+    state.PauseTiming();
+    assertTrue(isSorted(arr), "Quicksort");
+    arr = copy;
+    state.ResumeTiming();
+  }
+
+  state.counters["ProcessCPU"] =
+      benchmark::Counter(cpuSeconds, benchmark::Counter::kAvgIterations);
+}
+
+// Inputs for the sort benchmarks
+enum SortInput { INPUT_UNIFORM, INPUT_SORTED, INPUT_REVERSED, INPUT_FEW_UNIQUE };
+// Sort algorithms compared by BM_Sort
+enum SortAlgorithm { SORT_QUICKSORT, SORT_SAMPLE };
+
+std::vector<int> sortInput(SortInput input, size_t n) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dist;
+  std::uniform_int_distribution<int> fewUnique(0, 15);
+  std::vector<int> vec(n);
+  for (auto &elem : vec) {
+    elem = input == INPUT_FEW_UNIQUE ? fewUnique(gen) : dist(gen);
+  }
+  if (input == INPUT_SORTED) {
+    std::sort(vec.begin(), vec.end());
+  } else if (input == INPUT_REVERSED) {
+    std::sort(vec.begin(), vec.end(), std::greater<>());
+  }
+  return vec;
+}
+
+// Benchmark sorting 5 million ints of the given shape (state.range(0) is a
+// SortInput) with quicksort or sample sort (state.range(1) is a
+// SortAlgorithm). Checks the result against std::sort.
+static void BM_Sort(benchmark::State &state) {
+  SortAlgorithm algorithm = (SortAlgorithm)state.range(1);
+  std::vector<int> input = sortInput((SortInput)state.range(0), 5000000);
+  std::vector<int> expected(input);
+  std::sort(expected.begin(), expected.end());
+  std::vector<int> arr(input);
+
+  for (auto _ : state) {
+    scheduler->run(
+        [&arr, algorithm] {
+          if (algorithm == SORT_QUICKSORT) {
+            return quicksort(arr.data(), arr.data() + arr.size());
+          }
+          parallel_sample_sort(arr.begin(), arr.end());
+          return 0;
+        },
+        NUM_THREADS);
+    state.PauseTiming();
+    assertTrue(arr == expected, "Sort");
+    arr = input;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * arr.size());
+}
+
+// Benchmark quicksort on 5 million ints drawn from 2^state.range(0)
+// distinct keys
+static void BM_QuicksortCardinality(benchmark::State &state) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dist(
+      0, (int)((1LL << state.range(0)) - 1));
+  std::vector<int> input(5000000);
+  for (auto &elem : input) {
+    elem = dist(gen);
+  }
+  std::vector<int> arr(input);
+
+  for (auto _ : state) {
+    scheduler->run(
+        [&arr] { return quicksort(arr.data(), arr.data() + arr.size()); },
+        NUM_THREADS);
+    state.PauseTiming();
+    assertTrue(isSorted(arr), "Quicksort");
+    arr = input;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * arr.size());
 }
 
 // Configuration to benchmark quicksort on all schedulers
@@ -223,6 +1252,187 @@ BENCHMARK(BM_Quicksort)
     ->Setup(initChildSchedulerLF)
     ->Name("ChildSchedulerLF Quicksort");
 
+BENCHMARK(BM_Sort)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({INPUT_UNIFORM, SORT_QUICKSORT})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Quicksort Uniform");
+BENCHMARK(BM_Sort)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({INPUT_SORTED, SORT_QUICKSORT})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Quicksort Sorted");
+BENCHMARK(BM_Sort)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({INPUT_REVERSED, SORT_QUICKSORT})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Quicksort Reversed");
+BENCHMARK(BM_Sort)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({INPUT_FEW_UNIQUE, SORT_QUICKSORT})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Quicksort Few Unique");
+BENCHMARK(BM_Sort)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({INPUT_UNIFORM, SORT_SAMPLE})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Sample Sort Uniform");
+BENCHMARK(BM_Sort)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({INPUT_SORTED, SORT_SAMPLE})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Sample Sort Sorted");
+BENCHMARK(BM_Sort)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({INPUT_REVERSED, SORT_SAMPLE})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Sample Sort Reversed");
+BENCHMARK(BM_Sort)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({INPUT_FEW_UNIQUE, SORT_SAMPLE})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Sample Sort Few Unique");
+BENCHMARK(BM_QuicksortCardinality)
+    ->Unit(benchmark::kMillisecond)
+    ->DenseRange(1, 31, 3)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Quicksort Cardinality");
+
+BENCHMARK(BM_NQueens)
+    ->Unit(benchmark::kMillisecond)
+    ->DenseRange(14, 18)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Bitboard N-Queens");
+BENCHMARK(BM_NQueensFirst)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{16, 20}, {0, 1}})
+    ->ArgNames({"n", "cancel"})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF N-Queens First");
+
+BENCHMARK(BM_RectmulKernel)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{KERNEL_SCALAR}, {1, NUM_THREADS}})
+    ->ArgNames({"kernel", "threads"})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Scalar Kernel");
+BENCHMARK(BM_RectmulKernel)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{KERNEL_PORTABLE}, {1, NUM_THREADS}})
+    ->ArgNames({"kernel", "threads"})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Portable Kernel");
+BENCHMARK(BM_RectmulKernel)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{KERNEL_AVX2}, {1, NUM_THREADS}})
+    ->ArgNames({"kernel", "threads"})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul AVX2 Kernel");
+BENCHMARK(BM_RectmulKernel)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{KERNEL_AVX512}, {1, NUM_THREADS}})
+    ->ArgNames({"kernel", "threads"})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul AVX-512 Kernel");
+BENCHMARK(BM_RectmulSplitY)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(0)
+    ->Arg(64)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Split Y");
+// 4K and 8K matrices. 16K matrices need about 12GB, add 1024 to the block
+// counts to run them.
+BENCHMARK(BM_RectmulLayout)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{256, 512}, {LAYOUT_ROW_MAJOR, LAYOUT_MORTON}})
+    ->ArgNames({"blocks", "layout"})
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Layout");
+// 1K and 2K matrices
+BENCHMARK(BM_RectmulStrassen)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{64, 128}, {0, 4, 8, 16, -1}})
+    ->ArgNames({"blocks", "crossover"})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Strassen");
+// 1000 isn't a multiple of any block edge
+BENCHMARK_TEMPLATE(BM_RectmulTyped, double, 16)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1000)
+    ->Arg(1024)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Double 16");
+BENCHMARK_TEMPLATE(BM_RectmulTyped, double, 8)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1000)
+    ->Arg(1024)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Double 8");
+BENCHMARK_TEMPLATE(BM_RectmulTyped, float, 16)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1000)
+    ->Arg(1024)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Float 16");
+BENCHMARK_TEMPLATE(BM_RectmulTyped, float, 32)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1000)
+    ->Arg(1024)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Float 32");
+BENCHMARK_TEMPLATE(BM_RectmulTyped, int32_t, 16)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1000)
+    ->Arg(1024)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Rectmul Int32 16");
+
 // Configuration to benchmark fib on all schedulers
 BENCHMARK(BM_Fib)
     ->Unit(benchmark::kMillisecond)
@@ -249,6 +1459,218 @@ BENCHMARK(BM_Fib)
     ->Setup(initChildSchedulerLF)
     ->Name("ChildSchedulerLF Fib");
 
+// Only the lock-free child scheduler supports submitting from outside the pool
+BENCHMARK(BM_SubmitLatency)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({4, 2000})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Name("ChildSchedulerLF Submit Latency");
+
+BENCHMARK(BM_Arenas)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(0)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Name("ArenaScheduler Shared Arena");
+BENCHMARK(BM_Arenas)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Name("ArenaScheduler Isolated Arenas");
+
+BENCHMARK(BM_Priority)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(0)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Name("ChildSchedulerLF Equal Priority Latency");
+BENCHMARK(BM_Priority)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Name("ChildSchedulerLF High Priority Latency");
+
+BENCHMARK(BM_HeatAffinity)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({0, 100})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat");
+BENCHMARK(BM_HeatAffinity)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({1, 100})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Affinity");
+BENCHMARK(BM_Heat)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(20)
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Grid");
+BENCHMARK(BM_HeatTrapezoid)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{HEAT_SWEEP, HEAT_TRAPEZOID}, {32}})
+    ->ArgNames({"mode", "steps"})
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Trapezoid");
+BENCHMARK(BM_HeatConcurrent)
+    ->Unit(benchmark::kMillisecond)
+    ->RangeMultiplier(2)
+    ->Range(1, 8)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Concurrent");
+BENCHMARK(BM_HeatDataflow)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(HEAT_SWEEP)
+    ->Arg(HEAT_DATAFLOW)
+    ->ArgName("mode")
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Dataflow");
+BENCHMARK(BM_Stencil2D)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{STENCIL_SWEEP, STENCIL_TRAPEZOID}, {32}})
+    ->ArgNames({"mode", "steps"})
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Stencil 9 Point 2D");
+BENCHMARK(BM_Stencil3D)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{STENCIL_SWEEP, STENCIL_TRAPEZOID}, {32}})
+    ->ArgNames({"mode", "steps"})
+    ->Iterations(1)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Stencil 7 Point 3D");
+
+BENCHMARK(BM_LoopNBody)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_LAZY)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF NBody Lazy Loop");
+BENCHMARK(BM_LoopNBody)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_STATIC)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF NBody Static Loop");
+BENCHMARK(BM_LoopNBody)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_DYNAMIC)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF NBody Dynamic Loop");
+BENCHMARK(BM_LoopNBody)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_GUIDED)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF NBody Guided Loop");
+BENCHMARK(BM_LoopNBody)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_ADAPTIVE)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF NBody Adaptive Loop");
+BENCHMARK(BM_NBodyBarnesHut)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{2000, 100000}, {50}})
+    ->ArgNames({"particles", "theta%"})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF NBody Barnes-Hut");
+BENCHMARK(BM_LoopHeat)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_LAZY)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Lazy Loop");
+BENCHMARK(BM_LoopHeat)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_STATIC)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Static Loop");
+BENCHMARK(BM_LoopHeat)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_DYNAMIC)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Dynamic Loop");
+BENCHMARK(BM_LoopHeat)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_GUIDED)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Guided Loop");
+BENCHMARK(BM_LoopHeat)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(SCHEDULE_ADAPTIVE)
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Heat Adaptive Loop");
+
+// Reductions and scans over 10^6 to 10^8 elements. 10^9 elements need about
+// 4GB for reduce and 12GB for scan, add ->Arg(1000000000) to run them.
+BENCHMARK(BM_Accumulate)
+    ->Unit(benchmark::kMillisecond)
+    ->RangeMultiplier(10)
+    ->Range(1000000, 100000000)
+    ->Name("Serial Accumulate");
+BENCHMARK(BM_ParallelReduce)
+    ->Unit(benchmark::kMillisecond)
+    ->RangeMultiplier(10)
+    ->Range(1000000, 100000000)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Parallel Reduce");
+BENCHMARK(BM_InclusiveScan)
+    ->Unit(benchmark::kMillisecond)
+    ->RangeMultiplier(10)
+    ->Range(1000000, 100000000)
+    ->Name("Serial Inclusive Scan");
+BENCHMARK(BM_ParallelScan)
+    ->Unit(benchmark::kMillisecond)
+    ->RangeMultiplier(10)
+    ->Range(1000000, 100000000)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Parallel Inclusive Scan");
+
+BENCHMARK(BM_QuicksortThreads)
+    ->Unit(benchmark::kMillisecond)
+    ->ArgsProduct({{12, 24, 48, 64}, {0, 1}})
+    ->ArgNames({"threads", "parallel_partition"})
+    ->Iterations(3)
+    ->UseRealTime()
+    ->Setup(initChildSchedulerLF)
+    ->Name("ChildSchedulerLF Quicksort");
+
 // BENCHMARK(BM_NQueens)
 //     ->Unit(benchmark::kMillisecond)
 //     ->Arg(14)
@@ -324,23 +1746,23 @@ BENCHMARK(BM_Fib)
 
 // BENCHMARK(BM_Heat)
 //     ->Unit(benchmark::kMillisecond)
-//     ->Arg(1)
+//     ->Arg(400)
 //     ->Setup(initNoSpawnScheduler)
 //     ->Name("NoSpawnScheduler Heat");
 // BENCHMARK(BM_Heat)
 //     ->Unit(benchmark::kMillisecond)
-//     ->Arg(1)
+//     ->Arg(400)
 //     ->Setup(initSimpleScheduler)
 //     ->Name("SimpleScheduler Heat");
 // BENCHMARK(BM_Heat)
 //     ->Unit(benchmark::kMillisecond)
-//     ->Arg(1)
+//     ->Arg(400)
 //     ->Iterations(3)
 //     ->Setup(initChildScheduler)
 //     ->Name("ChildScheduler Heat");
 // BENCHMARK(BM_Heat)
 //     ->Unit(benchmark::kMillisecond)
-//     ->Arg(1)
+//     ->Arg(400)
 //     ->Iterations(3)
 //     ->Setup(initChildScheduler)
 //     ->Name("ChildSchedulerLF Heat");
@@ -0,0 +1,265 @@
+/**
+ * @file parallel_for.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Parallel loops built on the global scheduler. parallel_for uses lazy
+ * binary splitting (Tzannes, Caragea, Barua and Vishkin): a thread works
+ * through its range a chunk at a time and only splits off half of it when
+ * its own queue is empty, i.e. when there is nothing left for an idle thread
+ * to steal. So the loop is split about as finely as the machine needs and no
+ * finer, without hand tuning the grain size.
+ *
+ * Loops can also pick an OpenMP style schedule instead. Uniform loops are
+ * cheapest with static blocks, irregular ones balance better when iterations
+ * are handed out from a shared counter. Reducers see the iterations in serial
+ * order with SCHEDULE_LAZY and SCHEDULE_STATIC. The other schedules hand out
+ * iterations in whatever order workers ask for them.
+ *
+ * Loops stop handing out iterations once the task group they run in is
+ * cancelled (see schedulers/task_group.hpp). Iterations already started
+ * finish.
+ */
+
+#ifndef PARALLEL_FOR_HPP
+#define PARALLEL_FOR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <type_traits>
+#include <vector>
+
+#include "../scheduler_instance.hpp"
+
+// How parallel_for hands out iterations, modelled on OpenMP's schedule
+// clause. Every policy but SCHEDULE_LAZY runs the loop with one task per
+// worker, each hinted to run on its own worker.
+enum LoopSchedule {
+  // Lazy binary splitting on the work stealing queues
+  SCHEDULE_LAZY,
+  // One contiguous block per worker
+  SCHEDULE_STATIC,
+  // Chunks of grain iterations from a shared counter
+  SCHEDULE_DYNAMIC,
+  // Chunks of the remaining iterations divided by the number of workers from
+  // a shared counter, so they shrink towards grain as the loop drains
+  SCHEDULE_GUIDED,
+  // Starts out static with a counter per block. A worker that finishes its
+  // block while others still have iterations left switches to taking guided
+  // chunks from the fullest block, so a balanced loop never touches another
+  // worker's counter and an unbalanced one rebalances as soon as a worker
+  // runs dry.
+  SCHEDULE_ADAPTIVE,
+};
+
+// Most iterations a thread runs between two looks at its queue. The chunk
+// starts at one iteration and doubles while the queue stays busy, so cheap
+// bodies don't pay for a check every iteration, but an expensive body is
+// never far from noticing that a thief took its last task.
+const int MAX_CHECK_INTERVAL = 64;
+
+template <typename Index, typename Body>
+void lazySplitFor(Index begin, Index end, const Body &body, Index grain) {
+  // Upper halves we handed out. Every split halves the range, so there are at
+  // most log2(end - begin) of them.
+  std::vector<std::future<int>> halves;
+  Index chunk = 1;
+
+  while (begin < end && !TaskGroup::cancelled()) {
+    // Nothing for a thief to take, so offer the lower half of what is left
+    // and go on with the upper half. A spawned task comes before its
+    // continuation in serial order, so this keeps reducers in iteration
+    // order.
+    if (end - begin > grain && !scheduler->hasLocalWork()) {
+      Index mid = begin + (end - begin) / 2;
+      halves.push_back(scheduler->spawn([begin, mid, &body, grain] {
+        lazySplitFor(begin, mid, body, grain);
+        return 0;
+      }));
+      begin = mid;
+      // Someone wanted work just now, so look again soon
+      chunk = 1;
+      continue;
+    }
+
+    Index stop = begin + std::min<Index>(chunk, end - begin);
+    for (; begin < stop; ++begin) {
+      body(begin);
+    }
+    if (chunk < MAX_CHECK_INTERVAL) {
+      chunk *= 2;
+    }
+  }
+
+  // Join the most recent (smallest) half first, it is the likeliest to still
+  // be sitting in our queue
+  for (auto it = halves.rbegin(); it != halves.rend(); ++it) {
+    scheduler->sync(std::move(*it));
+  }
+}
+
+// Run f(w) for every worker w, each as its own task hinted to run on worker w,
+// and wait for all of them. The last one runs on the calling thread, so in
+// serial order they run from 0 up.
+template <typename F> void onEachWorker(int workers, const F &f) {
+  std::vector<std::future<int>> futures;
+  for (int w = 0; w < workers - 1; w++) {
+    futures.push_back(scheduler->spawn(
+        [w, &f] {
+          f(w);
+          return 0;
+        },
+        Affinity::worker(w)));
+  }
+  f(workers - 1);
+  for (auto &fut : futures) {
+    scheduler->sync(std::move(fut));
+  }
+}
+
+// Start of block w when the len iterations from begin are cut into the given
+// number of equal blocks. Multiplied out in long long so int indices don't
+// overflow.
+template <typename Index>
+Index blockStart(Index begin, Index len, int w, int blocks) {
+  return begin + (Index)((long long)len * w / blocks);
+}
+
+// Claim the next chunk of [next, end): the remaining iterations divided by
+// divisor, but at least grain. Returns false once nothing is left.
+template <typename Index>
+bool takeGuidedChunk(std::atomic<Index> &next, Index end, int divisor,
+                     Index grain, Index &start, Index &stop) {
+  start = next.load(std::memory_order_relaxed);
+  do {
+    if (start >= end) {
+      return false;
+    }
+    Index remaining = end - start;
+    Index size = std::max<Index>(grain, remaining / divisor);
+    stop = start + std::min(size, remaining);
+  } while (!next.compare_exchange_weak(start, stop, std::memory_order_relaxed));
+  return true;
+}
+
+// A worker's block for SCHEDULE_ADAPTIVE. Its counter gets its own cache line
+// so the owner doesn't share it while the loop is balanced.
+template <typename Index> struct alignas(64) LoopBlock {
+  std::atomic<Index> next;
+  Index end;
+};
+
+template <typename Index, typename Body>
+void adaptiveFor(Index begin, Index end, const Body &body, Index grain,
+                 int workers) {
+  std::vector<LoopBlock<Index>> blocks(workers);
+  Index len = end - begin;
+  for (int w = 0; w < workers; w++) {
+    blocks[w].next = blockStart(begin, len, w, workers);
+    blocks[w].end = blockStart(begin, len, w + 1, workers);
+  }
+
+  onEachWorker(workers, [&](int w) {
+    Index start, stop;
+    LoopBlock<Index> *block = &blocks[w];
+    while (!TaskGroup::cancelled()) {
+      if (!takeGuidedChunk(block->next, block->end, workers, grain, start,
+                           stop)) {
+        // Our block ran dry, help out whichever block has the most left
+        block = nullptr;
+        Index most = 0;
+        for (auto &other : blocks) {
+          Index next = other.next.load(std::memory_order_relaxed);
+          if (next < other.end && other.end - next > most) {
+            most = other.end - next;
+            block = &other;
+          }
+        }
+        if (block == nullptr) {
+          return;
+        }
+        continue;
+      }
+      for (Index i = start; i < stop; ++i) {
+        body(i);
+      }
+    }
+  });
+}
+
+// Run body(i) for every i in [begin, end) in parallel with the given schedule
+// and return once all iterations are done. grain is the smallest chunk handed
+// out (for SCHEDULE_LAZY the smallest range worth splitting).
+template <typename Index, typename Body>
+void parallel_for(Index begin, std::type_identity_t<Index> end,
+                  const Body &body, LoopSchedule schedule,
+                  std::type_identity_t<Index> grain = 1) {
+  if (begin >= end) {
+    return;
+  }
+  grain = std::max<Index>(grain, 1);
+  int workers = std::max(1, scheduler->numWorkers());
+
+  switch (schedule) {
+  case SCHEDULE_LAZY:
+    lazySplitFor<Index, Body>(begin, end, body, grain);
+    return;
+
+  case SCHEDULE_STATIC: {
+    Index len = end - begin;
+    onEachWorker(workers, [&](int w) {
+      Index stop = blockStart(begin, len, w + 1, workers);
+      for (Index i = blockStart(begin, len, w, workers); i < stop; ++i) {
+        body(i);
+      }
+    });
+    return;
+  }
+
+  case SCHEDULE_DYNAMIC: {
+    std::atomic<Index> next = begin;
+    onEachWorker(workers, [&](int) {
+      while (true) {
+        Index start = next.fetch_add(grain, std::memory_order_relaxed);
+        if (start >= end || TaskGroup::cancelled()) {
+          return;
+        }
+        Index stop = start + std::min<Index>(grain, end - start);
+        for (Index i = start; i < stop; ++i) {
+          body(i);
+        }
+      }
+    });
+    return;
+  }
+
+  case SCHEDULE_GUIDED: {
+    std::atomic<Index> next = begin;
+    onEachWorker(workers, [&](int) {
+      Index start, stop;
+      while (!TaskGroup::cancelled() &&
+             takeGuidedChunk(next, end, workers, grain, start, stop)) {
+        for (Index i = start; i < stop; ++i) {
+          body(i);
+        }
+      }
+    });
+    return;
+  }
+
+  case SCHEDULE_ADAPTIVE:
+    adaptiveFor<Index, Body>(begin, end, body, grain, workers);
+    return;
+  }
+}
+
+// Run body(i) for every i in [begin, end) in parallel and return once all
+// iterations are done. Ranges of at most grain iterations are never split.
+template <typename Index, typename Body>
+void parallel_for(Index begin, std::type_identity_t<Index> end,
+                  const Body &body, std::type_identity_t<Index> grain = 1) {
+  parallel_for(begin, end, body, SCHEDULE_LAZY, grain);
+}
+
+#endif
@@ -0,0 +1,87 @@
+/**
+ * @file parallel_partition.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Parallel partition built on the global scheduler, using prefix sums.
+ * The range is cut into blocks and every block counts its elements that
+ * satisfy the predicate. An exclusive scan over the counts tells each block
+ * where its elements go on either side of the split, then all blocks scatter
+ * into a buffer in parallel and the buffer is copied back. The span is
+ * O(n / blocks + blocks) instead of O(n) for std::partition, at the cost of
+ * a buffer of n elements. Like std::stable_partition, elements keep their
+ * relative order on each side.
+ */
+
+#ifndef PARALLEL_PARTITION_HPP
+#define PARALLEL_PARTITION_HPP
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "parallel_for.hpp"
+#include "parallel_reduce.hpp"
+
+// Reorder [first, last) so the elements satisfying pred come first and
+// return the first element that doesn't. grain is the block size, 0 picks
+// one from the size of the range.
+template <typename It, typename Pred>
+It parallel_partition(It first, It last, const Pred &pred,
+                      std::ptrdiff_t grain = 0) {
+  using T = typename std::iterator_traits<It>::value_type;
+  std::ptrdiff_t n = std::distance(first, last);
+  if (grain <= 0) {
+    grain = defaultGrain(n);
+  }
+  if (n <= grain) {
+    return std::stable_partition(first, last, pred);
+  }
+  std::ptrdiff_t blocks = (n + grain - 1) / grain;
+
+  // Count the elements of every block that go to the front
+  std::vector<std::ptrdiff_t> front(blocks);
+  parallel_for(std::ptrdiff_t(0), blocks, [&](std::ptrdiff_t b) {
+    It begin = first + b * grain;
+    It end = first + std::min(n, (b + 1) * grain);
+    front[b] = std::count_if(begin, end, pred);
+  });
+
+  // Where each block's front and back elements start in the buffer
+  std::vector<std::ptrdiff_t> back(blocks);
+  std::ptrdiff_t totalFront = 0;
+  for (std::ptrdiff_t b = 0; b < blocks; b++) {
+    std::ptrdiff_t count = front[b];
+    front[b] = totalFront;
+    totalFront += count;
+  }
+  for (std::ptrdiff_t b = 0; b < blocks; b++) {
+    back[b] = totalFront + b * grain - front[b];
+  }
+
+  // Not value initialized, so the buffer isn't written serially first
+  std::unique_ptr<T[]> buffer(new T[n]);
+  parallel_for(std::ptrdiff_t(0), blocks, [&](std::ptrdiff_t b) {
+    It end = first + std::min(n, (b + 1) * grain);
+    T *f = buffer.get() + front[b];
+    T *k = buffer.get() + back[b];
+    for (It it = first + b * grain; it != end; ++it) {
+      if (pred(*it)) {
+        *f++ = std::move(*it);
+      } else {
+        *k++ = std::move(*it);
+      }
+    }
+  });
+
+  parallel_for(std::ptrdiff_t(0), blocks, [&](std::ptrdiff_t b) {
+    std::ptrdiff_t begin = b * grain;
+    std::ptrdiff_t end = std::min(n, begin + grain);
+    std::move(buffer.get() + begin, buffer.get() + end, first + begin);
+  });
+
+  return first + totalFront;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * @file parallel_reduce.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Parallel reductions built on the global scheduler. The range is
+ * split in halves down to the grain size, every leaf is reduced serially and
+ * the partial results are combined up the tree. The tree only depends on the
+ * size of the range and the grain, so floating point results are the same
+ * from run to run. op must be associative and is called both as op(V, V) and
+ * op(V, element).
+ */
+
+#ifndef PARALLEL_REDUCE_HPP
+#define PARALLEL_REDUCE_HPP
+
+#include <algorithm>
+#include <future>
+#include <iterator>
+
+#include "../scheduler_instance.hpp"
+
+// Leaves smaller than this aren't worth a spawn
+const int MIN_REDUCE_GRAIN = 4096;
+
+// Grain used when the caller doesn't pick one: about eight leaves per worker,
+// so stealing can even out the load.
+template <typename Size> Size defaultGrain(Size n) {
+  Size workers = std::max(1, scheduler->numWorkers());
+  return std::max<Size>(MIN_REDUCE_GRAIN, n / (8 * workers));
+}
+
+// Serial reduction of value(i) for i in [0, n), n > 0. Four independent
+// accumulators, each over its own quarter of the range, break the dependency
+// between iterations so the compiler can keep four operations in flight. The
+// quarters are combined left to right, so op needn't be commutative.
+template <typename V, typename Size, typename Op, typename F>
+V reduceNonEmpty(Size n, const Op &op, const F &value) {
+  if (n < 4) {
+    V acc = value(0);
+    for (Size i = 1; i < n; i++) {
+      acc = op(acc, value(i));
+    }
+    return acc;
+  }
+
+  Size q = n / 4;
+  V acc0 = value(0), acc1 = value(q), acc2 = value(2 * q),
+    acc3 = value(3 * q);
+  for (Size i = 1; i < q; i++) {
+    acc0 = op(acc0, value(i));
+    acc1 = op(acc1, value(q + i));
+    acc2 = op(acc2, value(2 * q + i));
+    acc3 = op(acc3, value(3 * q + i));
+  }
+  // The last quarter also takes what doesn't divide evenly
+  for (Size i = 4 * q; i < n; i++) {
+    acc3 = op(acc3, value(i));
+  }
+  return op(op(op(acc0, acc1), acc2), acc3);
+}
+
+// Reduce value(i) for i in [begin, end)
+template <typename Size, typename V, typename Op, typename F>
+V reduceRange(Size begin, Size end, const V &identity, const Op &op,
+              const F &value, Size grain) {
+  if (end - begin <= grain) {
+    return reduceNonEmpty<V>(end - begin, op,
+                             [begin, &value](Size i) { return value(begin + i); });
+  }
+
+  Size mid = begin + (end - begin) / 2;
+  V left = identity;
+  auto fut = scheduler->spawn([&] {
+    left = reduceRange(begin, mid, identity, op, value, grain);
+    return 0;
+  });
+  V right = reduceRange(mid, end, identity, op, value, grain);
+  scheduler->sync(std::move(fut));
+  return op(left, right);
+}
+
+// Reduce the elements of [first, last) with op. grain is the largest leaf
+// reduced serially, 0 picks one from the size of the range.
+template <typename It, typename V, typename Op>
+V parallel_reduce(It first, It last, V identity, const Op &op,
+                  std::ptrdiff_t grain = 0) {
+  std::ptrdiff_t n = std::distance(first, last);
+  if (n <= 0) {
+    return identity;
+  }
+  if (grain <= 0) {
+    grain = defaultGrain(n);
+  }
+  return reduceRange(
+      std::ptrdiff_t(0), n, identity, op,
+      [first](std::ptrdiff_t i) -> decltype(auto) { return first[i]; },
+      grain);
+}
+
+// Reduce transform(i) for every index i in [begin, end) with op, like
+// std::transform_reduce over indices.
+template <typename Index, typename V, typename Op, typename F>
+V parallel_transform_reduce(Index begin, std::type_identity_t<Index> end,
+                            V identity, const Op &op, const F &transform,
+                            std::type_identity_t<Index> grain = 0) {
+  if (begin >= end) {
+    return identity;
+  }
+  if (grain <= 0) {
+    grain = defaultGrain<Index>(end - begin);
+  }
+  return reduceRange(begin, end, identity, op, transform, grain);
+}
+
+#endif
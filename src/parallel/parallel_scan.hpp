@@ -0,0 +1,87 @@
+/**
+ * @file parallel_scan.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Parallel prefix sums built on the global scheduler. The input is cut
+ * into blocks. The first pass reduces every block in parallel, a short serial
+ * scan over the block sums gives each block its starting value, and the second
+ * pass scans every block in parallel from that value. That is about 2n
+ * applications of op against n for the serial scan, independent of the number
+ * of workers. Input and output may be the same range.
+ */
+
+#ifndef PARALLEL_SCAN_HPP
+#define PARALLEL_SCAN_HPP
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include "parallel_for.hpp"
+#include "parallel_reduce.hpp"
+
+// Scan [first, last) into out. Block b starts from offsets[b]. inclusive
+// picks whether out[i] includes element i.
+template <typename InIt, typename OutIt, typename V, typename Op>
+void scanBlocks(InIt first, std::ptrdiff_t n, OutIt out, const V &start,
+                const Op &op, std::ptrdiff_t grain, bool inclusive) {
+  std::ptrdiff_t blocks = (n + grain - 1) / grain;
+
+  // Pass 1: sum of every block but the last, whose sum nobody needs
+  std::vector<V> offsets(blocks, start);
+  parallel_for(std::ptrdiff_t(0), blocks - 1, [&](std::ptrdiff_t b) {
+    InIt block = first + b * grain;
+    offsets[b + 1] = reduceNonEmpty<V>(
+        grain, op, [block](std::ptrdiff_t i) -> decltype(auto) { return block[i]; });
+  });
+
+  // Turn the block sums into the value each block starts from
+  for (std::ptrdiff_t b = 1; b < blocks; b++) {
+    offsets[b] = op(offsets[b - 1], offsets[b]);
+  }
+
+  // Pass 2: scan every block from its offset
+  parallel_for(std::ptrdiff_t(0), blocks, [&](std::ptrdiff_t b) {
+    std::ptrdiff_t begin = b * grain;
+    std::ptrdiff_t end = std::min(n, begin + grain);
+    V acc = offsets[b];
+    for (std::ptrdiff_t i = begin; i < end; i++) {
+      // Read before writing so out can alias first
+      V next = op(acc, first[i]);
+      out[i] = inclusive ? next : acc;
+      acc = next;
+    }
+  });
+}
+
+// out[i] = identity op x[0] op ... op x[i], like std::inclusive_scan. grain is
+// the block size, 0 picks one from the size of the range.
+template <typename InIt, typename OutIt, typename V, typename Op>
+void parallel_inclusive_scan(InIt first, InIt last, OutIt out, V identity,
+                             const Op &op, std::ptrdiff_t grain = 0) {
+  std::ptrdiff_t n = std::distance(first, last);
+  if (n <= 0) {
+    return;
+  }
+  if (grain <= 0) {
+    grain = defaultGrain(n);
+  }
+  scanBlocks(first, n, out, identity, op, grain, true);
+}
+
+// out[i] = init op x[0] op ... op x[i - 1], like std::exclusive_scan
+template <typename InIt, typename OutIt, typename V, typename Op>
+void parallel_exclusive_scan(InIt first, InIt last, OutIt out, V init,
+                             const Op &op, std::ptrdiff_t grain = 0) {
+  std::ptrdiff_t n = std::distance(first, last);
+  if (n <= 0) {
+    return;
+  }
+  if (grain <= 0) {
+    grain = defaultGrain(n);
+  }
+  scanBlocks(first, n, out, init, op, grain, false);
+}
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file reducer.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Cilk style reducer hyperobjects. A reducer looks like a single
+ * variable to the program, but every strand that updates it gets its own
+ * view, so parallel tasks can accumulate into it without locks. Views are
+ * combined in serial order when they are read, so the result is the same as
+ * if the program ran serially, as long as the monoid's reduce is associative.
+ *
+ *   Reducer<op_add<long long>> sum;
+ *   parallel_for(0, n, [&](int i) { *sum += f(i); });
+ *   long long total = sum.get();
+ *
+ * Create the reducer before spawning the tasks that use it and read it with
+ * get() after syncing them. See schedulers/views.hpp for how views are kept.
+ */
+
+#ifndef REDUCER_HPP
+#define REDUCER_HPP
+
+#include <algorithm>
+#include <limits>
+#include <list>
+#include <utility>
+
+#include "../schedulers/views.hpp"
+
+// A monoid has a View type, identity() and reduce(left, right), which sets
+// left = left op right. right is thrown away afterwards.
+template <typename V> struct op_add {
+  using View = V;
+  V identity() const { return V(); }
+  void reduce(V &left, V &right) const { left += right; }
+};
+
+template <typename V> struct op_min {
+  using View = V;
+  V identity() const { return std::numeric_limits<V>::max(); }
+  void reduce(V &left, V &right) const { left = std::min(left, right); }
+};
+
+template <typename V> struct op_max {
+  using View = V;
+  V identity() const { return std::numeric_limits<V>::lowest(); }
+  void reduce(V &left, V &right) const { left = std::max(left, right); }
+};
+
+// Elements come out in the order a serial run would have appended them
+template <typename E> struct op_list_append {
+  using View = std::list<E>;
+  View identity() const { return View(); }
+  void reduce(View &left, View &right) const {
+    left.splice(left.end(), right);
+  }
+};
+
+template <typename Monoid> class Reducer : public ReducerBase {
+public:
+  using View = typename Monoid::View;
+
+  explicit Reducer(Monoid monoid = Monoid())
+      : monoid(std::move(monoid)), leftmost(this->monoid.identity()) {
+    ViewFrame::reducerCreated();
+  }
+
+  Reducer(View init, Monoid monoid) : monoid(std::move(monoid)), leftmost(init) {
+    ViewFrame::reducerCreated();
+  }
+
+  Reducer(const Reducer &) = delete;
+  Reducer &operator=(const Reducer &) = delete;
+
+  ~Reducer() { ViewFrame::reducerDestroyed(this); }
+
+  // The calling strand's view. Only update it, its value on its own means
+  // nothing.
+  View &view() { return *static_cast<View *>(ViewFrame::view(this)); }
+  View &operator*() { return view(); }
+  View *operator->() { return &view(); }
+
+  // The value after every update so far, in serial order. Call it from the
+  // strand that created the reducer after syncing the tasks that updated it.
+  View &get() {
+    void *view = ViewFrame::takeView(this);
+    if (view != nullptr) {
+      reduceViews(&leftmost, view);
+    }
+    return leftmost;
+  }
+
+  void *createView() override { return new View(monoid.identity()); }
+
+  void reduceViews(void *left, void *right) override {
+    monoid.reduce(*static_cast<View *>(left), *static_cast<View *>(right));
+    destroyView(right);
+  }
+
+  void destroyView(void *view) override { delete static_cast<View *>(view); }
+
+private:
+  Monoid monoid;
+  // Value before the first update, and where get() folds everything into
+  View leftmost;
+};
+
+#endif
@@ -0,0 +1,188 @@
+/**
+ * @file sample_sort.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Parallel sample sort built on the global scheduler.
+ *
+ * 1. Pick splitters from a sorted random sample, oversampled so buckets come
+ *    out close to even whatever the input order.
+ * 2. Cut the input into blocks. Every block classifies its elements and
+ *    counts them per bucket in parallel.
+ * 3. A scan over the counts gives every block its output position in every
+ *    bucket, and all blocks scatter into a buffer in parallel. Each block
+ *    collects a few elements per bucket in a small buffer and writes them
+ *    out together, so scattering touches few cache lines at a time.
+ * 4. Sort every bucket in parallel and move it back.
+ *
+ * Every splitter also gets a bucket for keys equal to it, which needs no
+ * sorting. Inputs with few distinct keys then end up almost entirely in those
+ * buckets instead of in one huge bucket.
+ */
+
+#ifndef SAMPLE_SORT_HPP
+#define SAMPLE_SORT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "parallel_for.hpp"
+#include "parallel_reduce.hpp"
+
+// Ranges up to this size are just sorted with std::sort
+const int SAMPLE_SORT_CUTOFF = 1 << 16;
+// At most this many splitters, so classification stays a short binary
+// search and the scatter buffers of a block fit in L1/L2
+const int MAX_SPLITTERS = 255;
+// Sample this many elements per splitter
+const int OVERSAMPLE = 16;
+// Elements collected per bucket before a block writes them out
+const int SCATTER_BUFFER = 16;
+
+template <typename T, typename Compare> class SampleSorter {
+private:
+  const Compare &comp;
+  std::vector<T> splitters;
+
+public:
+  SampleSorter(const Compare &comp) : comp(comp) {}
+
+  template <typename It> void sort(It first, It last) {
+    std::ptrdiff_t n = std::distance(first, last);
+    if (n <= SAMPLE_SORT_CUTOFF) {
+      std::sort(first, last, comp);
+      return;
+    }
+
+    chooseSplitters(first, n);
+    int buckets = 2 * splitters.size() + 1;
+    std::ptrdiff_t grain = defaultGrain(n);
+    std::ptrdiff_t blocks = (n + grain - 1) / grain;
+
+    // Classify every element once and count per block and bucket
+    std::unique_ptr<uint16_t[]> bucketOf(new uint16_t[n]);
+    std::vector<std::ptrdiff_t> counts(blocks * buckets, 0);
+    parallel_for(std::ptrdiff_t(0), blocks, [&](std::ptrdiff_t b) {
+      std::ptrdiff_t end = std::min(n, (b + 1) * grain);
+      std::ptrdiff_t *count = &counts[b * buckets];
+      for (std::ptrdiff_t i = b * grain; i < end; i++) {
+        uint16_t bucket = classify(first[i]);
+        bucketOf[i] = bucket;
+        count[bucket]++;
+      }
+    });
+
+    // Bucket by bucket, block by block, so each bucket ends up contiguous
+    // and in input order
+    std::vector<std::ptrdiff_t> bucketStart(buckets + 1);
+    std::ptrdiff_t offset = 0;
+    for (int k = 0; k < buckets; k++) {
+      bucketStart[k] = offset;
+      for (std::ptrdiff_t b = 0; b < blocks; b++) {
+        std::ptrdiff_t count = counts[b * buckets + k];
+        counts[b * buckets + k] = offset;
+        offset += count;
+      }
+    }
+    bucketStart[buckets] = n;
+
+    // Not value initialized, so the buffer isn't written serially first
+    std::unique_ptr<T[]> buffer(new T[n]);
+    parallel_for(std::ptrdiff_t(0), blocks, [&](std::ptrdiff_t b) {
+      scatterBlock(first, b * grain, std::min(n, (b + 1) * grain),
+                   &counts[b * buckets], buckets, bucketOf.get(),
+                   buffer.get());
+    });
+
+    parallel_for(
+        0, buckets,
+        [&](int k) {
+          T *begin = buffer.get() + bucketStart[k];
+          T *end = buffer.get() + bucketStart[k + 1];
+          // Odd buckets only hold keys equal to a splitter
+          if (k % 2 == 0) {
+            std::sort(begin, end, comp);
+          }
+          std::move(begin, end, first + bucketStart[k]);
+        },
+        SCHEDULE_DYNAMIC);
+  }
+
+private:
+  template <typename It> void chooseSplitters(It first, std::ptrdiff_t n) {
+    int wanted = std::min<std::ptrdiff_t>(MAX_SPLITTERS,
+                                          n / SAMPLE_SORT_CUTOFF * 4);
+    wanted = std::max(wanted, 1);
+
+    // Fixed seed, so the same input always gets the same buckets
+    std::mt19937_64 gen(n);
+    std::uniform_int_distribution<std::ptrdiff_t> dist(0, n - 1);
+    std::vector<T> sample;
+    sample.reserve((wanted + 1) * OVERSAMPLE);
+    for (int i = 0; i < (wanted + 1) * OVERSAMPLE; i++) {
+      sample.push_back(first[dist(gen)]);
+    }
+    std::sort(sample.begin(), sample.end(), comp);
+
+    splitters.clear();
+    for (int i = 1; i <= wanted; i++) {
+      const T &candidate = sample[i * OVERSAMPLE - 1];
+      // Repeated keys get a single splitter, and with it an equality bucket
+      if (splitters.empty() || comp(splitters.back(), candidate)) {
+        splitters.push_back(candidate);
+      }
+    }
+  }
+
+  // Bucket 2j holds keys between splitter j - 1 and splitter j, bucket
+  // 2j + 1 keys equal to splitter j
+  uint16_t classify(const T &x) const {
+    auto it = std::lower_bound(splitters.begin(), splitters.end(), x, comp);
+    int j = it - splitters.begin();
+    if (it != splitters.end() && !comp(x, *it)) {
+      return 2 * j + 1;
+    }
+    return 2 * j;
+  }
+
+  // Move elements [begin, end) to their buckets. next[k] is where the
+  // block's next element of bucket k goes.
+  template <typename It>
+  void scatterBlock(It first, std::ptrdiff_t begin, std::ptrdiff_t end,
+                    std::ptrdiff_t *next, int buckets, const uint16_t *bucketOf,
+                    T *out) {
+    std::unique_ptr<T[]> staging(new T[buckets * SCATTER_BUFFER]);
+    std::vector<int> staged(buckets, 0);
+
+    for (std::ptrdiff_t i = begin; i < end; i++) {
+      int k = bucketOf[i];
+      T *slot = &staging[k * SCATTER_BUFFER];
+      slot[staged[k]++] = std::move(first[i]);
+      if (staged[k] == SCATTER_BUFFER) {
+        std::move(slot, slot + SCATTER_BUFFER, out + next[k]);
+        next[k] += SCATTER_BUFFER;
+        staged[k] = 0;
+      }
+    }
+
+    for (int k = 0; k < buckets; k++) {
+      T *slot = &staging[k * SCATTER_BUFFER];
+      std::move(slot, slot + staged[k], out + next[k]);
+      next[k] += staged[k];
+    }
+  }
+};
+
+// Sort [first, last) with comp in parallel. Not stable.
+template <typename It, typename Compare = std::less<>>
+void parallel_sample_sort(It first, It last, Compare comp = Compare()) {
+  using T = typename std::iterator_traits<It>::value_type;
+  SampleSorter<T, Compare>(comp).sort(first, last);
+}
+
+#endif
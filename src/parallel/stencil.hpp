@@ -0,0 +1,571 @@
+/**
+ * @file stencil.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Parallel stencil computations on the global scheduler, for grids of
+ * any dimension and element type.
+ *
+ * A Stencil owns two grids and alternates between them, so timestep s is
+ * computed from timestep s - 1 into the grid of timestep s - 2. Inner points
+ * are computed by a kernel from their neighbours, points within the kernel's
+ * radius of the edge of the grid by a boundary hook from their index and the
+ * timestep.
+ *
+ * The grid is cut into tiles of planes along its outermost dimension. A tile
+ * computes its points a line of the innermost dimension at a time. Lines
+ * start on cache lines and the two grids never overlap, so that loop
+ * vectorizes. Timesteps are walked either as one sweep of all tiles per
+ * timestep, as cache oblivious trapezoids covering many timesteps (see
+ * Stencil::trapezoid) or as a dataflow graph of tiles without barriers (see
+ * Stencil::dataflow).
+ *
+ * A kernel is a function object with a static constexpr int radius and
+ *   T operator()(const T *p, const std::array<long, D> &stride) const
+ * computing the new value of the point p points to. Its neighbour at offset
+ * (o_0, ..., o_D-1) is p[o_0 * stride[0] + ... + o_D-1 * stride[D - 1]], and
+ * offsets are at most radius in every dimension. A boundary hook is a
+ * function object with
+ *   T operator()(const std::array<long, D> &index, int timestep) const
+ */
+
+#ifndef STENCIL_HPP
+#define STENCIL_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "../scheduler_instance.hpp"
+#include "parallel_for.hpp"
+
+// Grids start on, and pad their lines to, this many bytes
+const int STENCIL_ALIGN = 64;
+
+// How a stencil walks through its timesteps
+enum StencilMode {
+  // Every timestep sweeps the whole grid in tiles
+  STENCIL_SWEEP,
+  // Cache oblivious trapezoids that cover several timesteps at once
+  STENCIL_TRAPEZOID,
+  // No barrier between timesteps. A tile runs a timestep as soon as it and
+  // its two neighbours are done with the one before, so fast tiles run
+  // ahead of stragglers.
+  STENCIL_DATAFLOW,
+};
+
+struct StencilOptions {
+  // Planes of the outermost dimension per tile
+  long tile = 1;
+  // How a sweep hands out tiles
+  LoopSchedule schedule = SCHEDULE_LAZY;
+  // Send every tile of a sweep to the same worker on every timestep
+  bool affinity = false;
+  StencilMode mode = STENCIL_SWEEP;
+  // Add up the CPU time spent computing tiles, see Stencil::busySeconds
+  bool timeTiles = false;
+};
+
+/*
+ * A D dimensional grid of T in one cache line aligned buffer, the last index
+ * varying fastest. Lines of the innermost dimension are padded to whole
+ * cache lines, and by one more if that makes them a multiple of 4 KB long,
+ * since such strides map the same element of every line to the same cache
+ * sets.
+ */
+template <typename T, int D> class StencilGrid {
+public:
+  using Index = std::array<long, D>;
+
+  explicit StencilGrid(const Index &extents) : ext(extents) {
+    long perLine = STENCIL_ALIGN / sizeof(T);
+    long ld = (ext[D - 1] + perLine - 1) / perLine * perLine;
+    if (D > 1 && (ld * sizeof(T)) % 4096 == 0) {
+      ld += perLine;
+    }
+    str[D - 1] = 1;
+    if (D > 1) {
+      str[D - 2] = ld;
+    }
+    for (int d = D - 3; d >= 0; d--) {
+      str[d] = str[d + 1] * ext[d + 1];
+    }
+    elements = D > 1 ? str[0] * ext[0] : ld;
+    size_t bytes = (elements * sizeof(T) + STENCIL_ALIGN - 1) /
+                   STENCIL_ALIGN * STENCIL_ALIGN;
+    // Pages aren't touched yet, see Stencil::init
+    buffer = (T *)aligned_alloc(STENCIL_ALIGN, bytes);
+  }
+
+  ~StencilGrid() { free(buffer); }
+
+  StencilGrid(const StencilGrid &) = delete;
+  StencilGrid &operator=(const StencilGrid &) = delete;
+
+  T *data() { return buffer; }
+  const T *data() const { return buffer; }
+
+  const Index &extents() const { return ext; }
+  // Distance between neighbours along each dimension, in elements
+  const Index &strides() const { return str; }
+  // Elements from one plane of the outermost dimension to the next,
+  // including padding
+  long planeSize() const { return D > 1 ? str[0] : 1; }
+  // Elements in the buffer, including padding
+  long size() const { return elements; }
+
+  long offset(const Index &i) const {
+    long o = 0;
+    for (int d = 0; d < D; d++) {
+      o += i[d] * str[d];
+    }
+    return o;
+  }
+
+  T &operator[](const Index &i) { return buffer[offset(i)]; }
+  const T &operator[](const Index &i) const { return buffer[offset(i)]; }
+
+private:
+  Index ext;
+  Index str;
+  long elements;
+  T *buffer;
+};
+
+template <typename T, int D, typename Kernel, typename Boundary>
+class Stencil {
+public:
+  using Index = std::array<long, D>;
+  static constexpr int R = Kernel::radius;
+
+  Stencil(const Index &extents, Kernel kernel, Boundary boundary,
+          StencilOptions options = StencilOptions())
+      : ext(extents), kernel(kernel), boundary(boundary), options(options) {
+    grids[0].reset(new StencilGrid<T, D>(extents));
+    grids[1].reset(new StencilGrid<T, D>(extents));
+  }
+
+  // Start over at timestep 0 with init(i) at every inner point i and the
+  // boundary hook's values elsewhere. The first call also touches both grids
+  // for the first time, tile by tile in parallel, so their pages end up near
+  // the workers computing them. Must be called from a task of the scheduler.
+  template <typename Init> void init(const Init &init) {
+    bool firstTouch = !touched;
+    touched = true;
+    step = 0;
+    busyNanos.store(0, std::memory_order_relaxed);
+    forTiles([&](long lo, long hi) {
+      if (firstTouch) {
+        touchPlanes(*grids[1], lo, hi);
+      }
+      initPlanes(init, lo, hi);
+    });
+  }
+
+  // Compute the next steps timesteps. Must be called from a task of the
+  // scheduler.
+  void run(int steps) {
+    if (steps <= 0) {
+      return;
+    }
+    if (options.mode == STENCIL_TRAPEZOID) {
+      trapezoid(step + 1, step + steps + 1, 0, 0, ext[0], 0);
+    } else if (options.mode == STENCIL_DATAFLOW) {
+      dataflow(step + 1, step + steps);
+    } else {
+      for (int s = step + 1; s <= step + steps; s++) {
+        forTiles([&](long lo, long hi) { computePlanes(lo, hi, s); });
+      }
+    }
+    step += steps;
+  }
+
+  // The current timestep
+  int timestep() const { return step; }
+
+  // The grid holding the current timestep
+  const StencilGrid<T, D> &grid() const { return *grids[step % 2]; }
+
+  // CPU time workers spent computing tiles since the last init, summed over
+  // workers. Only counted with StencilOptions::timeTiles. CPU time rather
+  // than wall clock time, so a worker the OS takes off its core in the
+  // middle of a tile doesn't count as busy meanwhile.
+  double busySeconds() const {
+    return busyNanos.load(std::memory_order_relaxed) * 1e-9;
+  }
+
+private:
+  // Tiles that have to finish a timestep before a tile can run the next, for
+  // timesteps of either parity. Padded so tiles don't share counters' cache
+  // lines.
+  struct alignas(64) TileCounter {
+    std::atomic<int> waiting[2];
+  };
+
+  Index ext;
+  Kernel kernel;
+  Boundary boundary;
+  StencilOptions options;
+  // Timestep s lives in grids[s % 2]
+  std::unique_ptr<StencilGrid<T, D>> grids[2];
+  int step = 0;
+  bool touched = false;
+  std::atomic<long long> busyNanos = 0;
+
+  // Compute planes [lo, hi) of timestep s from timestep s - 1. All planes of
+  // timestep s - 1 within the kernel's radius must be done already.
+  void computePlanes(long lo, long hi, int s) {
+    if (!options.timeTiles) {
+      planes(lo, hi, s);
+      return;
+    }
+    long long start = threadNanos();
+    planes(lo, hi, s);
+    busyNanos.fetch_add(threadNanos() - start, std::memory_order_relaxed);
+  }
+
+  static long long threadNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+  void planes(long lo, long hi, int s) {
+    const T *in = grids[(s + 1) % 2]->data();
+    T *out = grids[s % 2]->data();
+    const Index &stride = grids[0]->strides();
+
+    if constexpr (D == 1) {
+      long begin = std::max<long>(lo, R), end = std::min<long>(hi, ext[0] - R);
+      Index i;
+      for (i[0] = lo; i[0] < std::min(hi, begin); i[0]++) {
+        out[i[0]] = boundary(i, s);
+      }
+      for (i[0] = std::max(lo, end); i[0] < hi; i[0]++) {
+        out[i[0]] = boundary(i, s);
+      }
+      if (begin < end) {
+        line(out, in, begin, end, stride);
+      }
+    } else {
+      Index i{};
+      for (long p = lo; p < hi; p++) {
+        i[0] = p;
+        computeLines<1>(in, out, i, s, p < R || p >= ext[0] - R, stride);
+      }
+    }
+  }
+
+  // Call f(lo, hi) for every tile of planes [lo, hi) in parallel
+  template <typename F> void forTiles(const F &f) { forTiles(0, ext[0], f); }
+
+  // Same, over the planes [begin, end) only
+  template <typename F> void forTiles(long begin, long end, const F &f) {
+    if (options.affinity) {
+      tilesAffinity(begin, end, f);
+      return;
+    }
+    long tile = options.tile;
+    long tiles = (end - begin + tile - 1) / tile;
+    parallel_for(
+        0L, tiles,
+        [&](long k) {
+          f(begin + k * tile, std::min(end, begin + (k + 1) * tile));
+        },
+        options.schedule);
+  }
+
+  // Recursive split that mails every tile to the same worker every time.
+  // The left half stays here and the right half goes to the worker that
+  // owns its first plane.
+  template <typename F> void tilesAffinity(long lo, long hi, const F &f) {
+    if (hi - lo <= options.tile) {
+      f(lo, hi);
+      return;
+    }
+    long mid = (lo + hi) / 2;
+    auto right = scheduler->spawn(
+        [&, mid, hi]() -> int {
+          tilesAffinity(mid, hi, f);
+          return 0;
+        },
+        Affinity::range(mid, ext[0]));
+    tilesAffinity(lo, mid, f);
+    scheduler->sync(std::move(right));
+  }
+
+  static void touchPlanes(StencilGrid<T, D> &grid, long lo, long hi) {
+    long begin = lo * grid.planeSize();
+    long end = hi == grid.extents()[0] ? grid.size() : hi * grid.planeSize();
+    memset((void *)(grid.data() + begin), 0, (end - begin) * sizeof(T));
+  }
+
+  template <typename Init> void initPlanes(const Init &init, long lo, long hi) {
+    StencilGrid<T, D> &grid = *grids[0];
+    Index i{};
+    for (long p = lo; p < hi; p++) {
+      i[0] = p;
+      initPoints<1>(init, grid, i);
+    }
+  }
+
+  template <int d, typename Init>
+  void initPoints(const Init &init, StencilGrid<T, D> &grid, Index &i) {
+    if constexpr (d == D) {
+      grid[i] = onBoundary(i) ? boundary(i, 0) : init(i);
+    } else {
+      for (long j = 0; j < ext[d]; j++) {
+        i[d] = j;
+        initPoints<d + 1>(init, grid, i);
+      }
+    }
+  }
+
+  bool onBoundary(const Index &i) const {
+    for (int d = 0; d < D; d++) {
+      if (i[d] < R || i[d] >= ext[d] - R) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Compute the points whose indices start with i[0 .. d - 1], which lie on
+  // the boundary if edge
+  template <int d>
+  void computeLines(const T *in, T *out, Index &i, int s, bool edge,
+                    const Index &stride) {
+    if constexpr (d == D - 1) {
+      i[d] = 0;
+      long base = grids[0]->offset(i);
+      long n = ext[d];
+      if (edge || n <= 2 * R) {
+        for (long j = 0; j < n; j++) {
+          i[d] = j;
+          out[base + j] = boundary(i, s);
+        }
+        return;
+      }
+      for (long j = 0; j < R; j++) {
+        i[d] = j;
+        out[base + j] = boundary(i, s);
+        i[d] = n - 1 - j;
+        out[base + n - 1 - j] = boundary(i, s);
+      }
+      line(out + base, in + base, R, n - R, stride);
+    } else {
+      for (long j = 0; j < ext[d]; j++) {
+        i[d] = j;
+        computeLines<d + 1>(in, out, i, s, edge || j < R || j >= ext[d] - R,
+                            stride);
+      }
+    }
+  }
+
+  // Inner points [begin, end) of a line starting on a cache line
+  void line(T *__restrict out, const T *__restrict in, long begin, long end,
+            const Index &stride) const {
+    out = (T *)__builtin_assume_aligned(out, STENCIL_ALIGN);
+    in = (const T *)__builtin_assume_aligned(in, STENCIL_ALIGN);
+    const Kernel k = kernel;
+    const Index st = stride;
+    for (long j = begin; j < end; j++) {
+      out[j] = k(in + j, st);
+    }
+  }
+
+  /*
+   * Timesteps first to last without barriers. Tile k at timestep t reads
+   * planes of tiles k - 1, k and k + 1 at timestep t - 1, so it waits for
+   * those three, counted down in its TileCounter. Tiles are at least R
+   * planes thick, so nothing further away matters. Whoever finishes the
+   * last of them makes the tile ready. Nothing else needs ordering: the
+   * planes tile k overwrites at timestep t are those of timestep t - 2,
+   * whose readers are the same three tiles at timestep t - 1.
+   *
+   * A task carries on with one tile that its timestep made ready, itself if
+   * possible, so it keeps its planes in cache while it is ahead of its
+   * neighbours. Other tiles that became ready are spawned and synced once
+   * the task runs out of ready tiles.
+   */
+  void dataflow(int first, int last) {
+    long tile = std::max<long>(options.tile, R);
+    long tiles = (ext[0] + tile - 1) / tile;
+    std::vector<TileCounter> counters(tiles);
+    for (long k = 0; k < tiles; k++) {
+      int neighbours = std::min(k + 1, tiles - 1) - std::max(k - 1, 0L) + 1;
+      counters[k].waiting[0] = neighbours;
+      counters[k].waiting[1] = neighbours;
+    }
+
+    // Every tile is ready for the first timestep
+    parallel_for(
+        0L, tiles,
+        [&](long k) { dataflowTile(k, first, last, tile, counters); },
+        options.schedule);
+  }
+
+  void dataflowTile(long k, int t, int last, long tile,
+                    std::vector<TileCounter> &counters) {
+    std::vector<std::future<int>> spawned;
+    long tiles = counters.size();
+
+    while (true) {
+      computePlanes(k * tile, std::min(ext[0], (k + 1) * tile), t);
+      if (t == last) {
+        break;
+      }
+
+      // Tell the neighbours, and go on with the last one that became ready
+      long next = -1;
+      for (long j : {k - 1, k + 1, k}) {
+        if (j < 0 || j >= tiles) {
+          continue;
+        }
+        std::atomic<int> &waiting = counters[j].waiting[(t + 1) % 2];
+        if (waiting.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+          continue;
+        }
+        // Ready. Nobody counts down for timestep t + 3 before the tile has
+        // run t + 1, so the counter can be reset already.
+        int neighbours = std::min(j + 1, tiles - 1) - std::max(j - 1, 0L) + 1;
+        waiting.store(neighbours, std::memory_order_relaxed);
+        if (next >= 0) {
+          spawned.push_back(spawnTile(next, t + 1, last, tile, counters));
+        }
+        next = j;
+      }
+      if (next < 0) {
+        break;
+      }
+      k = next;
+      t++;
+    }
+
+    for (auto it = spawned.rbegin(); it != spawned.rend(); ++it) {
+      scheduler->sync(std::move(*it));
+    }
+  }
+
+  std::future<int> spawnTile(long k, int t, int last, long tile,
+                             std::vector<TileCounter> &counters) {
+    auto task = [=, this, &counters]() -> int {
+      dataflowTile(k, t, last, tile, counters);
+      return 0;
+    };
+    if (options.affinity) {
+      return scheduler->spawn(task, Affinity::range(k * tile, ext[0]));
+    }
+    return scheduler->spawn(task);
+  }
+
+  /*
+   * Cache oblivious walk after Frigo and Strumpen. A trapezoid covers the
+   * timesteps t0 to t1, and at timestep t0 + s the planes x0 + dx0 * R * s
+   * to x1 + dx1 * R * s. A plane only depends on the planes within R of it
+   * one timestep earlier, so the edges can have slopes -R, 0 or R and cutting
+   * along them never separates a plane from what it needs.
+   *
+   * Wide trapezoids are cut in space into two upright trapezoids, which are
+   * independent and run in parallel, and the inverted one between them,
+   * which runs after both. Tall ones are cut in time, the lower half first.
+   * Either way the recursion ends in trapezoids that fit in cache and are
+   * walked through several timesteps while there.
+   *
+   * Every point is computed from the same values as in a sweep, so results
+   * are bitwise identical. Two grids still suffice: a plane at timestep
+   * t + 1 overwrites the plane at t - 1, and every plane needing that one at
+   * timestep t is needed by the overwriting plane, so it must have run
+   * before.
+   */
+  void trapezoid(int t0, int t1, long x0, int dx0, long x1, int dx1) {
+    long h = t1 - t0;
+
+    if (h == 1) {
+      // The planes of a single timestep are independent, so a wide leaf (all
+      // of run(1), say) is spread over the workers a tile at a time
+      if (x1 - x0 > 2 * options.tile) {
+        forTiles(x0, x1, [&](long lo, long hi) { computePlanes(lo, hi, t0); });
+      } else if (x0 < x1) {
+        computePlanes(x0, x1, t0);
+      }
+      return;
+    }
+
+    // Room left over once both upright trapezoids have their slopes
+    long spare = (x1 - x0) - h * R * (2 + dx0 - dx1);
+    if (spare >= 2 * h * R) {
+      long xa = x0 + h * R * (1 + dx0) + spare / 2;
+      auto left = scheduler->spawn([=, this]() -> int {
+        trapezoid(t0, t1, x0, dx0, xa, -1);
+        return 0;
+      });
+      trapezoid(t0, t1, xa, 1, x1, dx1);
+      scheduler->sync(std::move(left));
+      trapezoid(t0, t1, xa, -1, xa, 1);
+      return;
+    }
+
+    long half = h / 2;
+    trapezoid(t0, t0 + half, x0, dx0, x1, dx1);
+    trapezoid(t0 + half, t1, x0 + dx0 * R * half, dx0, x1 + dx1 * R * half,
+              dx1);
+  }
+};
+
+/***************************** Stencil shapes *****************************/
+
+// 3 point stencil: u + c (u[x - 1] - 2u + u[x + 1])
+template <typename T> struct ThreePoint1D {
+  static constexpr int radius = 1;
+  T c;
+
+  T operator()(const T *p, const std::array<long, 1> &) const {
+    return c * (p[-1] - 2 * p[0] + p[1]) + p[0];
+  }
+};
+
+// 5 point stencil, explicit step of the heat equation:
+// u + cx (u[x + 1] - 2u + u[x - 1]) + cy (u[y + 1] - 2u + u[y - 1])
+template <typename T> struct FivePoint2D {
+  static constexpr int radius = 1;
+  T cx, cy;
+
+  T operator()(const T *p, const std::array<long, 2> &s) const {
+    return cx * (p[s[0]] - 2 * p[0] + p[-s[0]]) +
+           cy * (p[1] - 2 * p[0] + p[-1]) + p[0];
+  }
+};
+
+// 9 point stencil on the 3 x 3 box around a point, with one weight for the
+// centre, one for its 4 edge neighbours and one for its 4 corner neighbours
+template <typename T> struct NinePoint2D {
+  static constexpr int radius = 1;
+  T center, edge, corner;
+
+  T operator()(const T *p, const std::array<long, 2> &s) const {
+    const T *up = p - s[0];
+    const T *down = p + s[0];
+    return center * p[0] + edge * (up[0] + down[0] + p[-1] + p[1]) +
+           corner * (up[-1] + up[1] + down[-1] + down[1]);
+  }
+};
+
+// 7 point stencil: a point and its 6 face neighbours in 3D
+template <typename T> struct SevenPoint3D {
+  static constexpr int radius = 1;
+  T center, face;
+
+  T operator()(const T *p, const std::array<long, 3> &s) const {
+    return center * p[0] + face * (p[-s[0]] + p[s[0]] + p[-s[1]] + p[s[1]] +
+                                   p[-1] + p[1]);
+  }
+};
+
+#endif
@@ -1,3 +1,4 @@
+#include "schedulers/arena_scheduler.hpp"
 #include "schedulers/child_scheduler.hpp"
 #include "schedulers/child_scheduler_lf.hpp"
 #include "schedulers/no_spawn_scheduler.hpp"
@@ -7,4 +8,5 @@ SimpleScheduler<int> simpleScheduler;
 ChildSchedulerLF<int> childSchedulerLF;
 ChildScheduler<int> childScheduler;
 NoSpawnScheduler<int> noSpawnScheduler;
+ArenaScheduler<int> arenaScheduler;
 Scheduler<int> *scheduler = &noSpawnScheduler;
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include "schedulers/arena_scheduler.hpp"
 #include "schedulers/child_scheduler.hpp"
 #include "schedulers/child_scheduler_lf.hpp"
 #include "schedulers/no_spawn_scheduler.hpp"
@@ -8,4 +9,5 @@ extern SimpleScheduler<int> simpleScheduler;
 extern ChildSchedulerLF<int> childSchedulerLF;
 extern ChildScheduler<int> childScheduler;
 extern NoSpawnScheduler<int> noSpawnScheduler;
+extern ArenaScheduler<int> arenaScheduler;
 extern Scheduler<int> *scheduler;
\ No newline at end of file
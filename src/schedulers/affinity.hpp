@@ -0,0 +1,68 @@
+/**
+ * @file affinity.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Affinity hints for spawned tasks. A hint names the worker a task
+ * would like to run on, either directly or through a key that always maps to
+ * the same worker. Schedulers that support hints deliver the task to that
+ * worker's mailbox, so decompositions that are rebuilt the same way over and
+ * over (like heat's stripes every timestep) keep hitting the same caches.
+ * This is the locality-guided work stealing of Acar, Blelloch and Blumofe.
+ */
+
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+struct Affinity {
+  enum Kind {
+    // key is a worker id
+    WORKER,
+    // key is hashed onto a worker
+    KEY,
+    // key is an index into [0, total) split evenly across the workers
+    RANGE,
+  };
+
+  Kind kind;
+  size_t key;
+  size_t total;
+
+  static Affinity worker(int tid) { return Affinity{WORKER, (size_t)tid, 0}; }
+
+  static Affinity hash(size_t key) { return Affinity{KEY, key, 0}; }
+
+  // Tasks touching the same cache line of data go to the same worker
+  static Affinity data(const void *addr) {
+    return hash(reinterpret_cast<uintptr_t>(addr) >> 6);
+  }
+
+  // Neighbouring indices land on the same worker, so a recursive split of
+  // [0, total) only crosses workers near the boundaries.
+  static Affinity range(size_t index, size_t total) {
+    return Affinity{RANGE, index, total};
+  }
+
+  // The worker this hint asks for in a pool of n workers
+  int target(int n) const {
+    switch (kind) {
+    case WORKER:
+      return key % n;
+    case KEY: {
+      // splitmix64 finalizer, so that nearby keys spread out
+      uint64_t z = key + 0x9e3779b97f4a7c15ULL;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return (z ^ (z >> 31)) % n;
+    }
+    case RANGE:
+      return total == 0 ? 0 : (int)((uint64_t)key * n / total) % n;
+    }
+    return 0;
+  }
+};
+
+#endif
@@ -0,0 +1,510 @@
+/**
+ * @file arena_scheduler.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief A long-lived work stealing pool shared by several isolated arenas.
+ * Every arena has its own lock-free deque per worker and its own injection
+ * queue for submitted roots. An arena caps how many workers may run its tasks
+ * at once (its quota) and has a weight. Idle workers choose the next arena to
+ * serve by stride scheduling on the weights, among arenas that have queued
+ * work and are below quota. Inside an arena a worker only pops, steals and
+ * spawns within that arena, so a heavy job can't drag workers away from a
+ * latency sensitive one. An arena created as stealable lets workers that are
+ * blocked in sync in another arena help with its tasks.
+ *
+ * Workloads keep calling the Scheduler interface. spawn and sync act on the
+ * arena the calling worker is currently serving.
+ */
+
+#ifndef ARENA_SCHEDULER_HPP
+#define ARENA_SCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <functional>
+#include <future>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "backoff.hpp"
+#include "lock-free-queue/InjectionQueue.hpp"
+#include "lock-free-queue/Task.hpp"
+#include "lock-free-queue/TaskQueue.hpp"
+#include "scheduler.hpp"
+
+template <typename T> class ArenaScheduler : public Scheduler<T> {
+public:
+  // Throughput and latency of one arena since the pool was started
+  struct ArenaStats {
+    long long rootsCompleted;
+    long long tasksRun;
+    double meanLatencyUs;
+    double maxLatencyUs;
+  };
+
+  class Arena {
+    friend class ArenaScheduler;
+
+  public:
+    Arena(int maxConcurrency, int weight, bool stealable)
+        : maxConcurrency(maxConcurrency), weight(std::max(weight, 1)),
+          stealable(stealable) {}
+
+  private:
+    // Most workers that may run this arena's tasks at once
+    const int maxConcurrency;
+    // Share of worker turns relative to the other arenas
+    const int weight;
+    // Whether workers blocked in sync in other arenas may steal from here
+    const bool stealable;
+    // One deque per pool worker
+    std::vector<TaskQueue<T>> taskQueues;
+    // Roots submitted to this arena
+    InjectionQueue<Task<T>> injectionQueue{1 << 12};
+    // Number of tasks queued in this arena
+    std::atomic<int> taskCount = 0;
+    // Workers of this arena sleeping in sync, woken by new work here
+    SyncParking parking;
+    // Number of workers currently serving this arena
+    std::atomic<int> active = 0;
+    // Stride scheduling position. The arena with the lowest pass goes next.
+    std::atomic<long long> pass = 0;
+
+    std::atomic<long long> rootsCompleted = 0;
+    std::atomic<long long> tasksRun = 0;
+    std::atomic<long long> totalLatencyNs = 0;
+    std::atomic<long long> maxLatencyNs = 0;
+  };
+
+private:
+  // The scheduler the calling thread works for, if any, its integer thread
+  // id, and the arena it is currently serving.
+  struct WorkerId {
+    const void *owner = nullptr;
+    int tid = -1;
+    Arena *arena = nullptr;
+  };
+  static inline thread_local WorkerId self;
+
+  // Deques in an arena are sized for recursion, not for flat loops. Spawns
+  // past this run inline.
+  static constexpr int ARENA_QUEUE_CAPACITY = 1 << 15;
+  // A worker goes back to picking an arena after running this many tasks, so
+  // weights are honoured between arenas that all have backlogs.
+  static constexpr int TURN_LENGTH = 256;
+  // A worker leaves an arena after this many failed attempts to find work
+  static constexpr int MAX_MISSES = 64;
+  // Pass increment for an arena of weight 1
+  static constexpr long long STRIDE = 1 << 20;
+
+  // All the threads in the thread pool
+  std::vector<std::thread> threads;
+  // Arena 0 is the default arena used by run() and by non-worker spawns
+  std::vector<std::unique_ptr<Arena>> arenas;
+  // Each thread has a counter its children bump when they finish.
+  std::vector<JoinCounter> joinCounters;
+  // The number of threads in thread pool
+  int n = 0;
+  // Number of tasks queued across all arenas
+  std::atomic<int> taskCount = 0;
+  // Number of workers currently serving some arena
+  std::atomic<int> busyCount = 0;
+  // Pass of the most recently scheduled arena. Arenas that were idle start
+  // from here so they can't claim a burst of turns for the time they slept.
+  std::atomic<long long> virtualTime = 0;
+  bool started = false;
+  // Set by stop() to let workers exit once all work is drained
+  std::atomic<bool> stopping = false;
+  // Number of idle workers sleeping on wakeEpoch
+  std::atomic<int> sleepers = 0;
+  // Bumped to wake sleeping workers when work or quota becomes available
+  std::atomic<uint32_t> wakeEpoch = 0;
+
+public:
+  ArenaScheduler() {
+    arenas.push_back(std::make_unique<Arena>(INT_MAX, 1, false));
+  }
+
+  // The arena used by run() and by spawns from threads outside the pool
+  Arena *defaultArena() { return arenas[0].get(); }
+
+  // Create a new arena. Arenas must be created before start().
+  Arena *createArena(int maxConcurrency, int weight, bool stealable = false) {
+    arenas.push_back(
+        std::make_unique<Arena>(maxConcurrency, weight, stealable));
+    return arenas.back().get();
+  }
+
+  // Start a pool of n worker threads shared by all arenas.
+  void start(int n) {
+    this->n = n;
+    std::vector<JoinCounter> counters(n);
+    joinCounters.swap(counters);
+    for (auto &arena : arenas) {
+      arena->taskQueues.clear();
+      for (int i = 0; i < n; i++) {
+        arena->taskQueues.emplace_back(TaskQueue<T>(ARENA_QUEUE_CAPACITY));
+      }
+      arena->rootsCompleted = 0;
+      arena->tasksRun = 0;
+      arena->totalLatencyNs = 0;
+      arena->maxLatencyNs = 0;
+    }
+
+    started = true;
+    stopping = false;
+    for (int i = 0; i < n; i++) {
+      threads.emplace_back(&ArenaScheduler::workerThread, this, i);
+    }
+  }
+
+  // Wait for all submitted work to finish, then shut down the pool.
+  void stop() {
+    stopping = true;
+    wake(true);
+    for (auto &t : threads) {
+      t.join();
+    }
+    threads.clear();
+    started = false;
+  }
+
+  // Submit func as an independent root task of arena. Safe to call from any
+  // thread.
+  std::future<T> submit(Arena *arena, std::function<T()> func) {
+    // Roots running side by side each get their own reducer frame
+    func = ViewFrame::wrapRoot(std::move(func));
+    // Wrap func to record how long the root took from submission to finish
+    auto submitted = std::chrono::steady_clock::now();
+    std::packaged_task<T()> task([arena, submitted, func = std::move(func)] {
+      if constexpr (std::is_void<T>::value) {
+        func();
+        recordRoot(arena, submitted);
+      } else {
+        T result = func();
+        recordRoot(arena, submitted);
+        return result;
+      }
+    });
+    auto fut = task.get_future();
+
+    // Count the task before it becomes visible, see ChildSchedulerLF::submit
+    arena->taskCount.fetch_add(1, std::memory_order_seq_cst);
+    taskCount.fetch_add(1, std::memory_order_seq_cst);
+    Task<T> queued{std::move(task), getTid()};
+    while (!arena->injectionQueue.push(std::move(queued))) {
+      std::this_thread::yield();
+    }
+    wake(false);
+    arena->parking.wake(joinCounters);
+    return std::move(fut);
+  }
+
+  ArenaStats stats(const Arena *arena) const {
+    long long roots = arena->rootsCompleted.load();
+    double meanUs = roots == 0 ? 0.0 : arena->totalLatencyNs.load() / 1e3 / roots;
+    return ArenaStats{roots, arena->tasksRun.load(), meanUs,
+                      arena->maxLatencyNs.load() / 1e3};
+  }
+
+  // Run func in the default arena. Starts a pool of n threads for the call
+  // if none is running.
+  T run(std::function<T()> func, int n) {
+    if (started) {
+      return sync(submit(defaultArena(), func));
+    }
+
+    start(n);
+    auto fut = submit(defaultArena(), func);
+    stop();
+
+    // Return result of func if there is one
+    if constexpr (std::is_void<T>::value) {
+      fut.get();
+    } else {
+      return fut.get();
+    }
+  }
+
+  // Spawn func into the arena the calling worker is serving.
+  std::future<T> spawn(std::function<T()> func) {
+    int tid = getTid();
+    if (tid < 0) {
+      return submit(defaultArena(), func);
+    }
+
+    Arena *arena = self.arena;
+    std::packaged_task<T()> task(
+        ViewFrame::wrap(TaskGroup::wrap(std::move(func))));
+    auto fut = task.get_future();
+    Task<T> queued{std::move(task), tid};
+    // Our queue is full, so just run the task now
+    if (!arena->taskQueues[tid].push(std::move(queued))) {
+      queued.func();
+      return std::move(fut);
+    }
+
+    arena->taskCount.fetch_add(1, std::memory_order_seq_cst);
+    taskCount.fetch_add(1, std::memory_order_seq_cst);
+    wake(false);
+    arena->parking.wake(joinCounters);
+    return std::move(fut);
+  }
+
+  int numWorkers() { return n; }
+
+  bool hasLocalWork() {
+    int tid = getTid();
+    return tid >= 0 && !self.arena->taskQueues[tid].empty();
+  }
+
+  // Run tasks of our arena, or of stealable arenas, while waiting on fut.
+  T sync(std::future<T> fut) {
+    int tid = getTid();
+    if (tid < 0) {
+      return fut.get();
+    }
+
+    Backoff backoff;
+    std::atomic<uint32_t> &joins = joinCounters[tid].count;
+    uint32_t seen = joins.load(std::memory_order_acquire);
+    // Only new tasks of our own arena wake us up, see runSyncTask
+    Arena *arena = self.arena;
+
+    while (fut.wait_for(std::chrono::milliseconds(0)) !=
+           std::future_status::ready) {
+      while (!runSyncTask(tid) &&
+             !arena->parking.wait(backoff, joinCounters[tid], seen,
+                                  arena->taskCount)) {
+      }
+      backoff.reset();
+      seen = joins.load(std::memory_order_acquire);
+    }
+
+    // Return result of future if there is one
+    if constexpr (std::is_void<T>::value) {
+      fut.get();
+    } else {
+      return fut.get();
+    }
+  }
+
+private:
+  // Get the callling threads integer thread ID, or -1 if it is not one of
+  // our workers
+  int getTid() { return self.owner == this ? self.tid : -1; }
+
+  static void recordRoot(Arena *arena,
+                         std::chrono::steady_clock::time_point submitted) {
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - submitted)
+                       .count();
+    arena->rootsCompleted.fetch_add(1, std::memory_order_relaxed);
+    arena->totalLatencyNs.fetch_add(ns, std::memory_order_relaxed);
+    long long prev = arena->maxLatencyNs.load(std::memory_order_relaxed);
+    while (prev < ns && !arena->maxLatencyNs.compare_exchange_weak(
+                            prev, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  // Uniformly random index in [0, count)
+  static size_t randomIndex(size_t count) {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_int_distribution<size_t> distribution(0, count - 1);
+    return distribution(gen);
+  }
+
+  size_t GetRandomTaskQueue() { return randomIndex(n); }
+
+  // Find a task in arena: our own deque, then the arena's submitted roots,
+  // then a random victim's deque in the same arena.
+  std::optional<Task<T>> getTask(Arena *arena, int tid) {
+    std::optional<Task<T>> task = arena->taskQueues[tid].pop();
+    if (!task.has_value() && !arena->injectionQueue.empty()) {
+      task = arena->injectionQueue.pop();
+    }
+    if (!task.has_value()) {
+      size_t victim = GetRandomTaskQueue();
+      if (victim != static_cast<size_t>(tid)) {
+        task = arena->taskQueues[victim].steal();
+      }
+    }
+
+    if (task.has_value()) {
+      arena->taskCount.fetch_sub(1, std::memory_order_relaxed);
+      taskCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  // Let the thread that spawned task know it finished. Roots submitted from
+  // outside the pool have no parent to signal.
+  void signalParent(const Task<T> &task) {
+    if (task.parent >= 0) {
+      joinCounters[task.parent].signal();
+    }
+  }
+
+  // Run one task while blocked in sync. Looks in our own arena first, and
+  // otherwise steals from a random stealable arena.
+  bool runSyncTask(int tid) {
+    Arena *arena = self.arena;
+    std::optional<Task<T>> task = getTask(arena, tid);
+
+    if (!task.has_value()) {
+      Arena *other = arenas[randomIndex(arenas.size())].get();
+      if (other == arena || !other->stealable ||
+          other->taskCount.load(std::memory_order_relaxed) == 0) {
+        return false;
+      }
+      size_t victim = GetRandomTaskQueue();
+      task = other->taskQueues[victim].steal();
+      if (!task.has_value()) {
+        return false;
+      }
+      other->taskCount.fetch_sub(1, std::memory_order_relaxed);
+      taskCount.fetch_sub(1, std::memory_order_relaxed);
+      arena = other;
+    }
+
+    // Whatever the task spawns belongs to the arena it came from
+    Arena *home = self.arena;
+    self.arena = arena;
+    TaskGroup::runDetached(task->func);
+    self.arena = home;
+    signalParent(*task);
+    return true;
+  }
+
+  // True if some arena has queued work and room under its quota
+  bool anyRunnable() {
+    for (auto &arena : arenas) {
+      if (arena->taskCount.load(std::memory_order_seq_cst) > 0 &&
+          arena->active.load(std::memory_order_seq_cst) <
+              arena->maxConcurrency) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Pick the runnable arena with the lowest pass and take a slot in its
+  // quota. Returns nullptr if there is none.
+  Arena *enterArena() {
+    Arena *best = nullptr;
+    long long bestPass = LLONG_MAX;
+    for (auto &arena : arenas) {
+      if (arena->taskCount.load(std::memory_order_relaxed) == 0 ||
+          arena->active.load(std::memory_order_relaxed) >=
+              arena->maxConcurrency) {
+        continue;
+      }
+      long long pass = arena->pass.load(std::memory_order_relaxed);
+      if (pass < bestPass) {
+        best = arena.get();
+        bestPass = pass;
+      }
+    }
+    if (best == nullptr) {
+      return nullptr;
+    }
+
+    int active = best->active.load(std::memory_order_relaxed);
+    do {
+      if (active >= best->maxConcurrency) {
+        return nullptr;
+      }
+    } while (!best->active.compare_exchange_weak(active, active + 1));
+
+    // Charge the arena for this turn. Races between workers only make the
+    // shares slightly less exact.
+    long long startPass =
+        std::max(bestPass, virtualTime.load(std::memory_order_relaxed));
+    virtualTime.store(startPass, std::memory_order_relaxed);
+    best->pass.store(startPass + STRIDE / best->weight,
+                     std::memory_order_relaxed);
+    busyCount.fetch_add(1, std::memory_order_seq_cst);
+    return best;
+  }
+
+  void leaveArena(Arena *arena) {
+    busyCount.fetch_sub(1, std::memory_order_seq_cst);
+    arena->active.fetch_sub(1, std::memory_order_seq_cst);
+    // A worker waiting on this arena's quota may go now
+    wake(false);
+  }
+
+  // Run tasks from arena until it runs dry or our turn is over.
+  void serve(Arena *arena, int tid) {
+    self.arena = arena;
+    long long ran = 0;
+    int misses = 0;
+    while (ran < TURN_LENGTH && misses < MAX_MISSES) {
+      std::optional<Task<T>> task = getTask(arena, tid);
+      if (!task.has_value()) {
+        misses++;
+        cpuRelax();
+        continue;
+      }
+
+      misses = 0;
+      TaskGroup::runDetached(task->func);
+      signalParent(*task);
+      ran++;
+    }
+    self.arena = nullptr;
+    arena->tasksRun.fetch_add(ran, std::memory_order_relaxed);
+  }
+
+  // Wake sleeping workers because work or quota became available, or because
+  // we are shutting down (force).
+  void wake(bool force) {
+    if (force || sleepers.load(std::memory_order_seq_cst) > 0) {
+      wakeEpoch.fetch_add(1, std::memory_order_seq_cst);
+      wakeEpoch.notify_all();
+    }
+  }
+
+  // Spin for a while and then sleep until some arena becomes runnable. Same
+  // protocol as ChildSchedulerLF::idle.
+  void idle(Backoff &backoff) {
+    if (!backoff.exhausted()) {
+      backoff.spin();
+      return;
+    }
+
+    sleepers.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t epoch = wakeEpoch.load(std::memory_order_seq_cst);
+    if (!anyRunnable() && !stopping) {
+      wakeEpoch.wait(epoch, std::memory_order_seq_cst);
+    }
+    sleepers.fetch_sub(1, std::memory_order_seq_cst);
+    backoff.reset();
+  }
+
+  void workerThread(int tid) {
+    self = WorkerId{this, tid, nullptr};
+    Backoff backoff;
+
+    while (true) {
+      Arena *arena = enterArena();
+      if (arena == nullptr) {
+        if (stopping && taskCount == 0 && busyCount == 0) {
+          break;
+        }
+        idle(backoff);
+        continue;
+      }
+
+      backoff.reset();
+      serve(arena, tid);
+      leaveArena(arena);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * @file backoff.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Helpers for waiting on other threads without hammering shared cache
+ * lines. A thread that has nothing to do first spins with an exponentially
+ * growing number of pause instructions, and once that stops paying off it
+ * parks on a futex (std::atomic::wait) until the word it is watching changes.
+ */
+
+#ifndef BACKOFF_HPP
+#define BACKOFF_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Tell the CPU we are in a spin loop. This frees up pipeline resources for
+// the sibling hyperthread and avoids a memory order violation flush when the
+// watched cache line finally changes.
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+// A per-thread counter that is bumped every time one of the thread's spawned
+// children finishes. A thread waiting in sync only needs to look at its future
+// again once this counter moves. Padded to a cache line so that children
+// signalling one worker don't invalidate a neighbouring worker's counter.
+struct alignas(64) JoinCounter {
+  std::atomic<uint32_t> count = 0;
+  // Set while the thread sleeps in sync, see SyncParking
+  std::atomic<bool> parked = false;
+
+  // Called by whoever ran the child, after the child's future was set.
+  void signal() {
+    count.fetch_add(1, std::memory_order_release);
+    count.notify_all();
+  }
+};
+
+// Exponential backoff on a single 32-bit word.
+class Backoff {
+private:
+  // Largest spin round is 2^MAX_SPIN_STEP pause instructions. After that many
+  // fruitless rounds we stop burning the core and sleep on the futex.
+  static constexpr int MAX_SPIN_STEP = 10;
+  int step = 0;
+
+public:
+  // Wait for word to change from old. Spins for the current round and
+  // returns false if the word is unchanged afterwards, so the caller can go
+  // look for other work in between rounds. Once spinning has been exhausted
+  // this blocks until the word changes. Returns true if the word changed.
+  bool wait(const std::atomic<uint32_t> &word, uint32_t old) {
+    if (step > MAX_SPIN_STEP) {
+      word.wait(old, std::memory_order_acquire);
+      return true;
+    }
+
+    for (int i = 0; i < (1 << step); i++) {
+      if (word.load(std::memory_order_acquire) != old) {
+        return true;
+      }
+      cpuRelax();
+    }
+
+    step++;
+    return false;
+  }
+
+  // Spin for the current round without watching anything. Used by callers
+  // that need to do their own bookkeeping before going to sleep, see
+  // exhausted().
+  void spin() {
+    for (int i = 0; i < (1 << step); i++) {
+      cpuRelax();
+    }
+    step++;
+  }
+
+  // True once spinning has stopped paying off and the caller should sleep
+  bool exhausted() const { return step > MAX_SPIN_STEP; }
+
+  // Start over with short spins after making progress.
+  void reset() { step = 0; }
+};
+
+// Threads waiting in sync sleep on their own join counter, which only their
+// children bump, so new work spawned elsewhere would not wake them. Producers
+// of stealable work check here whether any thread is parked and, if so, bump
+// the join counter of one of them to make it look for work again.
+class SyncParking {
+private:
+  // Number of threads sleeping in sync
+  std::atomic<int> parked = 0;
+
+public:
+  // Like Backoff::wait, but once spinning is exhausted only sleep while
+  // queued shows no tasks anywhere. A thread only goes to sleep after
+  // announcing itself in parked and then seeing no queued tasks, while every
+  // producer counts its task before calling wake(), so a wakeup can't be
+  // lost. Returns true if the caller should look at its future again.
+  bool wait(Backoff &backoff, JoinCounter &joins, uint32_t old,
+            const std::atomic<int> &queued) {
+    if (!backoff.exhausted()) {
+      return backoff.wait(joins.count, old);
+    }
+
+    joins.parked.store(true, std::memory_order_seq_cst);
+    parked.fetch_add(1, std::memory_order_seq_cst);
+    bool slept = queued.load(std::memory_order_seq_cst) == 0;
+    if (slept) {
+      joins.count.wait(old, std::memory_order_acquire);
+    } else {
+      // Work is queued somewhere, so go look for it again soon
+      std::this_thread::yield();
+    }
+    parked.fetch_sub(1, std::memory_order_seq_cst);
+    joins.parked.store(false, std::memory_order_relaxed);
+    return slept;
+  }
+
+  // Called after a new task was counted in queued. One task only needs one
+  // thread, so this wakes a single parked thread, claiming it so that
+  // concurrent producers wake different ones.
+  template <typename Counters> void wake(Counters &joinCounters) {
+    if (parked.load(std::memory_order_seq_cst) == 0) {
+      return;
+    }
+    for (auto &counter : joinCounters) {
+      bool expected = true;
+      if (counter.parked.load(std::memory_order_relaxed) &&
+          counter.parked.compare_exchange_strong(expected, false,
+                                                 std::memory_order_seq_cst)) {
+        counter.signal();
+        return;
+      }
+    }
+  }
+};
+
+#endif
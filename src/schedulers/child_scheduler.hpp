@@ -9,20 +9,26 @@
  * thread's deque. Threads only steal from their own queue while synchronizing
  * (waiting on dependencies).
  *
+ * Each deque is split into priority lanes. Threads take from higher lanes
+ * first, both from their own deque and when stealing, with aging so lower
+ * lanes still make progress.
  */
 
 #ifndef CHILD_SCHEDULER_HPP
 #define CHILD_SCHEDULER_HPP
 
+#include <array>
 #include <deque>
 #include <functional>
 #include <future>
 #include <iostream>
 #include <mutex>
+#include <optional>
 #include <random>
 #include <thread>
 #include <vector>
 
+#include "backoff.hpp"
 #include "scheduler.hpp"
 
 template <typename T> class ChildScheduler : public Scheduler<T> {
@@ -30,22 +36,36 @@ private:
   // A task that a thread can run.
   struct Task {
     std::packaged_task<T()> func;
+    // Thread that spawned this task and will eventually sync on it
+    int parent;
+    // Lane the task was queued in
+    Priority priority;
   };
+  // A thread's deque, split into one lane per priority
+  using Lanes = std::array<std::deque<Task>, NUM_PRIORITIES>;
   // All the threads in the thread pool
   std::vector<std::thread> threads;
   // Map from std::thread::id to an integer thread id that is easier to work
   // with.
   std::unordered_map<std::thread::id, int> threadIds;
   // Each thread has an associated queue of tasks for it to run.
-  std::vector<std::deque<Task>> taskQueues;
+  std::vector<Lanes> taskQueues;
+  // Each thread's aging state for choosing which lane to take from
+  std::vector<LaneAging> agings;
   // Each task queue has an associated mutex for accessing.
   std::vector<std::mutex> locks;
+  // Each thread has a counter its children bump when they finish.
+  std::vector<JoinCounter> joinCounters;
+  // Threads sleeping in sync, woken by spawns
+  SyncParking parking;
   // The number of threads in thread pool
   int n;
   // Number of tasks across all queues
   std::atomic<int> taskCount = 0;
   // Number of threads currently doing work
   std::atomic<int> workCount = 0;
+  // Priority of the task the calling thread is running
+  static inline thread_local Priority curPriority = PRIORITY_NORMAL;
 
 public:
   ChildScheduler() {}
@@ -55,9 +75,13 @@ public:
   // all threads are joined.
   T run(std::function<T()> func, int n) {
     this->n = n;
-    taskQueues.resize(n);
+    std::vector<Lanes> queues(n);
+    taskQueues.swap(queues);
     std::vector<std::mutex> muts(n);
     locks.swap(muts);
+    std::vector<JoinCounter> counters(n);
+    joinCounters.swap(counters);
+    agings.assign(n, LaneAging());
     taskCount = 1;
 
     for (int i = 1; i < n; i++) {
@@ -68,9 +92,10 @@ public:
     }
 
     threadIds[std::this_thread::get_id()] = 0;
-    std::packaged_task<T()> task(func);
+    std::packaged_task<T()> task(ViewFrame::wrapRoot(std::move(func)));
     auto fut = task.get_future();
-    taskQueues[0].emplace_front(Task{std::move(task)});
+    taskQueues[0][PRIORITY_NORMAL].emplace_front(
+        Task{std::move(task), 0, PRIORITY_NORMAL});
 
     workerThread(0);
 
@@ -93,55 +118,63 @@ public:
   // Spawn new function to potentially be run in parallel.
   // This function gets stored on this thread's task queue and can be stolen
   // later by this thread, or another thread if another thread runs out of work.
+  // The task gets the priority of the task that spawns it.
   std::future<T> spawn(std::function<T()> func) {
-    std::packaged_task<T()> task(func);
+    return spawn(std::move(func), curPriority);
+  }
+
+  std::future<T> spawn(std::function<T()> func, Priority priority) {
+    std::packaged_task<T()> task(
+        ViewFrame::wrap(TaskGroup::wrap(std::move(func))));
     int tid = getTid();
     auto fut = task.get_future();
     {
       // Lock current thread's task queue before accessing
       std::unique_lock<std::mutex> lock(locks[tid]);
-      taskQueues[tid].emplace_front(Task{std::move(task)});
+      taskQueues[tid][priority].emplace_front(
+          Task{std::move(task), tid, priority});
     }
 
-    taskCount.fetch_add(1, std::memory_order_relaxed);
+    // Count the task before looking for threads parked in sync, see
+    // SyncParking::wait
+    taskCount.fetch_add(1, std::memory_order_seq_cst);
+    parking.wake(joinCounters);
     return std::move(fut);
   }
 
+  int numWorkers() { return n; }
+
+  bool hasLocalWork() {
+    int tid = getTid();
+    std::unique_lock<std::mutex> lock(locks[tid]);
+    return !isEmpty(taskQueues[tid]);
+  }
+
   // Attempt to steal work while waiting on fut to finish
   T sync(std::future<T> fut) {
     int tid = getTid();
-    int curTid = tid;
+    Backoff backoff;
+
+    // Polling the future takes its internal lock, which contends with the
+    // child trying to complete it. Our children bump our join counter after
+    // setting their future, so we only check the future again once the
+    // counter moves or we ran a task ourselves. The counter must be read
+    // before the future is checked so that a completion in between isn't
+    // missed.
+    std::atomic<uint32_t> &joins = joinCounters[tid].count;
+    uint32_t seen = joins.load(std::memory_order_acquire);
 
-    // While future is not valid, attempt to steal work
     while (fut.wait_for(std::chrono::milliseconds(0)) !=
            std::future_status::ready) {
-      Task task;
-      bool foundTask = false;
-      {
-        {
-          std::unique_lock<std::mutex> lock(locks[tid]);
-          if (taskQueues[tid].empty()) {
-            curTid = GetRandomTaskQueue();
-          }
-        }
-        std::unique_lock<std::mutex> lock(locks[curTid]);
-        if (!taskQueues[curTid].empty()) {
-          foundTask = true;
-          task = std::move(taskQueues[curTid].front());
-          taskQueues[curTid].pop_front();
-        }
+      // Steal work until something happens that could have finished fut.
+      // With nothing to steal, spin on the join counter with exponential
+      // backoff and eventually sleep on it until a child finishes or new
+      // work is spawned.
+      while (!runSyncTask(tid) &&
+             !parking.wait(backoff, joinCounters[tid], seen, taskCount)) {
       }
-
-      if (foundTask) {
-        taskCount.fetch_sub(1, std::memory_order_relaxed);
-      } else {
-        curTid = tid;
-        continue;
-      }
-
-      // There is a task to run. Execute it!
-      task.func();
-      curTid = tid;
+      backoff.reset();
+      seen = joins.load(std::memory_order_acquire);
     }
 
     // Return result of future if there is one
@@ -156,6 +189,70 @@ private:
   // Get the callling threads integer thread ID
   int getTid() { return threadIds[std::this_thread::get_id()]; }
 
+  // Try to take one task, from our own queue if it has any and from a random
+  // queue otherwise, and run it. Returns false if no task was found.
+  bool runSyncTask(int tid) {
+    int curTid = tid;
+    std::optional<Task> task;
+    {
+      {
+        std::unique_lock<std::mutex> lock(locks[tid]);
+        if (isEmpty(taskQueues[tid])) {
+          curTid = GetRandomTaskQueue();
+        }
+      }
+      std::unique_lock<std::mutex> lock(locks[curTid]);
+      task = takeTask(taskQueues[curTid], agings[tid], true);
+    }
+
+    if (!task.has_value()) {
+      return false;
+    }
+    taskCount.fetch_sub(1, std::memory_order_relaxed);
+
+    // There is a task to run. Execute it!
+    execute(*task);
+    return true;
+  }
+
+  static bool isEmpty(const Lanes &lanes) {
+    for (const auto &lane : lanes) {
+      if (!lane.empty()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Take a task from the front or back of lanes, whose lock must be held.
+  // Higher lanes go first, see LaneAging.
+  std::optional<Task> takeTask(Lanes &lanes, LaneAging &aging, bool front) {
+    return aging.take([&](int lane) -> std::optional<Task> {
+      std::deque<Task> &queue = lanes[lane];
+      if (queue.empty()) {
+        return std::nullopt;
+      }
+      std::optional<Task> task;
+      if (front) {
+        task = std::move(queue.front());
+        queue.pop_front();
+      } else {
+        task = std::move(queue.back());
+        queue.pop_back();
+      }
+      return task;
+    });
+  }
+
+  // Run task at its own priority and let its parent know it finished.
+  void execute(Task &task) {
+    Priority prevPriority = curPriority;
+    curPriority = task.priority;
+    TaskGroup::runDetached(task.func);
+    curPriority = prevPriority;
+    joinCounters[task.parent].signal();
+  }
+
   size_t GetRandomTaskQueue() {
     static std::random_device rd;
     static std::mt19937 gen(rd());
@@ -171,30 +268,21 @@ private:
     // queue If we find any work to do, pop the work off and complete it! This
     // naive way of finding work might cause a lot of contention!
     while (true) {
-      Task task;
-      bool foundTask = false;
+      std::optional<Task> task;
       {
         std::unique_lock<std::mutex> lock(locks[tid]);
-        if (taskQueues[tid].empty()) {
+        if (isEmpty(taskQueues[tid])) {
           curTid = GetRandomTaskQueue();
         }
       }
 
       {
+        // Our own tasks come off the front, stolen ones off the back
         std::unique_lock<std::mutex> lock(locks[curTid]);
-        if (!taskQueues[curTid].empty()) {
-          foundTask = true;
-          if (curTid == tid) {
-            task = std::move(taskQueues[curTid].front());
-            taskQueues[curTid].pop_front();
-          } else {
-            task = std::move(taskQueues[curTid].back());
-            taskQueues[curTid].pop_back();
-          }
-        }
+        task = takeTask(taskQueues[curTid], agings[tid], curTid == tid);
       }
 
-      if (foundTask) {
+      if (task.has_value()) {
         workCount.fetch_add(1, std::memory_order_relaxed);
         taskCount.fetch_sub(1, std::memory_order_relaxed);
       } else {
@@ -213,7 +301,7 @@ private:
 
       // There is a task to run. Execute it!
       curTid = tid;
-      task.func();
+      execute(*task);
       workCount.fetch_sub(1, std::memory_order_relaxed);
     }
   }
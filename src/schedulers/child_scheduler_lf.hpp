@@ -6,20 +6,41 @@
  * @brief A child stealing scheduler. Each thread has its own deque and each
  * thread will add and take from the bottom from their queues. If a thread has
  * no work they can steal from other queues using cmp exhange.
+ *
+ * The scheduler can also be started as a long-lived pool with start(). Any
+ * thread, worker or not, can then submit() independent root tasks. Those go
+ * through a lock-free injection queue which idle workers check after their
+ * own queue and before stealing.
+ *
+ * Every queue is split into priority lanes. Threads take from higher lanes
+ * first, both locally and when stealing, with aging so lower lanes still make
+ * progress. A lane is searched in every place a thread may take work from
+ * before the next lane down, so a high priority root never waits behind a
+ * worker's own normal work.
+ *
+ * Spawns can carry an affinity hint. The task then goes to the mailbox of the
+ * worker the hint names, which that worker checks as soon as the same lane
+ * of its own queue runs dry. Thieves look in a victim's mailbox after its
+ * queue, so a busy worker's mail still gets run.
  */
 
 #ifndef CHILD_SCHEDULER_LF_HPP
 #define CHILD_SCHEDULER_LF_HPP
 
+#include <array>
 #include <deque>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <random>
 #include <thread>
 #include <vector>
 
+#include "affinity.hpp"
+#include "backoff.hpp"
+#include "lock-free-queue/InjectionQueue.hpp"
 #include "lock-free-queue/Task.hpp"
 #include "lock-free-queue/TaskQueue.hpp"
 #include "scheduler.hpp"
@@ -28,46 +49,123 @@ template <typename T> class ChildSchedulerLF : public Scheduler<T> {
 private:
   // All the threads in the thread pool
   std::vector<std::thread> threads;
-  // Map from std::thread::id to an integer thread id that is easier to work
-  // with.
-  std::unordered_map<std::thread::id, int> threadIds;
+  // The scheduler the calling thread works for, if any, and its integer
+  // thread id in that scheduler's pool. Threads outside the pool can still
+  // submit work.
+  struct WorkerId {
+    const void *owner = nullptr;
+    int tid = -1;
+    // Priority of the task the thread is running
+    Priority priority = PRIORITY_NORMAL;
+  };
+  static inline thread_local WorkerId self;
+  // A thread's queue, split into one lane per priority
+  using Lanes = std::array<TaskQueue<T>, NUM_PRIORITIES>;
+  // Most tasks run at normal priority, so the other lanes get smaller
+  // buffers. Spawns that don't fit run inline.
+  static constexpr int SIDE_LANE_CAPACITY = 1 << 14;
   // Each thread has an associated queue of tasks for it to run.
-  std::vector<TaskQueue<T>> taskQueues;
+  std::vector<Lanes> taskQueues;
+  // Each thread's aging state for choosing which lane to take from
+  std::vector<LaneAging> agings;
+  // Each thread has a counter its children bump when they finish. Mailing a
+  // task to a thread bumps it too, since that is all a thread parked in sync
+  // listens to.
+  std::vector<JoinCounter> joinCounters;
+  // Threads sleeping in sync, woken along with idle workers by wake()
+  SyncParking parking;
+  // Root tasks submitted from any thread, one queue per priority
+  InjectionQueue<Task<T>> injectionQueues[NUM_PRIORITIES];
+  // Tasks spawned with an affinity hint for each thread, one queue per
+  // priority, stored at tid * NUM_PRIORITIES + priority. The queue isn't
+  // movable, so each one lives behind a pointer.
+  static constexpr int MAILBOX_CAPACITY = 1 << 12;
+  std::vector<std::unique_ptr<InjectionQueue<Task<T>>>> mailboxes;
   // The number of threads in thread pool
   int n;
   // Number of tasks across all queues
   std::atomic<int> taskCount = 0;
   // Number of threads currently doing work
   std::atomic<int> workCount = 0;
+  // True between start() and stop(). Workers stay alive while idle.
+  bool persistent = false;
+  // Set by stop() to let workers exit once all work is drained
+  std::atomic<bool> stopping = false;
+  // Number of idle workers sleeping on wakeEpoch
+  std::atomic<int> sleepers = 0;
+  // Bumped to wake sleeping workers when new work shows up
+  std::atomic<uint32_t> wakeEpoch = 0;
 
 public:
   ChildSchedulerLF() {}
 
+  // Start a long-lived pool of n worker threads. Until stop() is called, the
+  // workers wait for work instead of exiting, and run() and submit() hand
+  // their functions to the pool.
+  void start(int n) {
+    setup(n);
+    persistent = true;
+    stopping = false;
+    for (int i = 0; i < n; i++) {
+      threads.emplace_back(&ChildSchedulerLF::workerThread, this, i);
+    }
+  }
+
+  // Wait for all submitted work to finish, then shut down the pool.
+  void stop() {
+    stopping = true;
+    wake(true);
+    for (auto &t : threads) {
+      t.join();
+    }
+    threads.clear();
+    persistent = false;
+  }
+
+  // Submit func as an independent root task. Safe to call from any thread,
+  // including threads that are not part of the pool. The pool must have been
+  // started with start(), or a run() must be in progress.
+  std::future<T> submit(std::function<T()> func,
+                        Priority priority = PRIORITY_NORMAL) {
+    std::packaged_task<T()> task(ViewFrame::wrapRoot(std::move(func)));
+    auto fut = task.get_future();
+    // Count the task before it becomes visible so that workers never see an
+    // empty system while it is in flight.
+    taskCount.fetch_add(1, std::memory_order_seq_cst);
+    // A worker submitting a root is woken like for its own children
+    Task<T> queued{std::move(task), getTid(), priority};
+    while (!injectionQueues[priority].push(std::move(queued))) {
+      // Queue is full, wait for workers to drain it
+      std::this_thread::yield();
+    }
+    wake(false);
+    return std::move(fut);
+  }
+
   // Create a thread pool of size n, put func into main thread's task queue,
   // and call workerThread. This function returns when all work is done and
   // all threads are joined.
   T run(std::function<T()> func, int n) {
-    this->n = n;
-    // taskQueues.reserve(n);
-    taskCount = 1;
-
-    for (int i = 0; i < n; i++) {
-      // emplace_back efficiently stores the thread without needing an extra
-      // move
-      taskQueues.emplace_back(TaskQueue<T>());
+    // A pool is already running, so just hand func to it
+    if (persistent) {
+      return sync(submit(func));
     }
 
+    setup(n);
+    taskCount = 1;
+
     for (int i = 1; i < n; i++) {
       // emplace_back efficiently stores the thread without needing an extra
       // move
       threads.emplace_back(&ChildSchedulerLF::workerThread, this, i);
-      threadIds[threads[i - 1].get_id()] = i;
     }
-    threadIds[std::this_thread::get_id()] = 0;
-    std::packaged_task<T()> task(func);
+    std::packaged_task<T()> task(ViewFrame::wrapRoot(std::move(func)));
     auto fut = task.get_future();
-    taskQueues[0].push(Task<T>{std::move(task)});
+    taskQueues[0][PRIORITY_NORMAL].push(Task<T>{std::move(task), 0});
+
+    WorkerId caller = self;
     workerThread(0);
+    self = caller;
 
     // join threads when finished
     for (auto &t : threads) {
@@ -75,7 +173,6 @@ public:
     }
 
     threads.clear();
-    threadIds.clear();
 
     // Return result of func if there is one
     if constexpr (std::is_void<T>::value) {
@@ -88,27 +185,93 @@ public:
   // Spawn new function to potentially be run in parallel.
   // This function gets stored on this thread's task queue and can be stolen
   // later by this thread, or another thread if another thread runs out of work.
+  // The task gets the priority of the task that spawns it.
   std::future<T> spawn(std::function<T()> func) {
-    std::packaged_task<T()> task(func);
+    Priority priority = getTid() < 0 ? PRIORITY_NORMAL : self.priority;
+    return spawn(std::move(func), priority);
+  }
+
+  std::future<T> spawn(std::function<T()> func, Priority priority) {
     int tid = getTid();
+    // Threads outside the pool have no queue of their own
+    if (tid < 0) {
+      return submit(func, priority);
+    }
+
+    std::packaged_task<T()> task(
+        ViewFrame::wrap(TaskGroup::wrap(std::move(func))));
     auto fut = task.get_future();
-    taskQueues[tid].push(Task<T>{std::move(task)});
+    Task<T> queued{std::move(task), tid, priority};
+    // Our queue is full, so just run the task now
+    if (!taskQueues[tid][priority].push(std::move(queued))) {
+      execute(queued);
+      return std::move(fut);
+    }
 
-    taskCount.fetch_add(1, std::memory_order_relaxed);
+    taskCount.fetch_add(1, std::memory_order_seq_cst);
+    wake(false);
+    return std::move(fut);
+  }
+
+  // Spawn func with a hint about which worker should run it. If the hint
+  // names the calling thread this is a normal spawn.
+  std::future<T> spawn(std::function<T()> func, Affinity affinity) {
+    int tid = getTid();
+    if (tid < 0) {
+      return submit(func);
+    }
+    int target = affinity.target(n);
+    if (target == tid) {
+      return spawn(std::move(func));
+    }
+
+    std::packaged_task<T()> task(
+        ViewFrame::wrap(TaskGroup::wrap(std::move(func))));
+    auto fut = task.get_future();
+    Task<T> queued{std::move(task), tid, self.priority};
+    bool mailed = mailbox(target, queued.priority).push(std::move(queued));
+    // The target's mailbox is full, so keep the task ourselves instead
+    if (!mailed && !taskQueues[tid][queued.priority].push(std::move(queued))) {
+      execute(queued);
+      return std::move(fut);
+    }
+
+    taskCount.fetch_add(1, std::memory_order_seq_cst);
+    wake(false);
+    if (mailed) {
+      joinCounters[target].signal();
+    }
     return std::move(fut);
   }
 
   size_t GetRandomTaskQueue() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<> distribution(0, n - 1);
-    size_t index = static_cast<size_t>(std::round(distribution(gen)));
+    static thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_int_distribution<> distribution(0, n - 1);
+    size_t index = static_cast<size_t>(distribution(gen));
     return index;
   }
 
+  // Look for a task in our own queue, then in our mailbox, then in the
+  // submitted roots, then in a random victim's queue and mailbox. Each lane
+  // is searched in our own queue, mailbox and the roots before moving on to
+  // the next lane down, so aging also applies across them.
   std::optional<Task<T>> getTask(int curTid) {
-    TaskQueue<T> &queue = taskQueues[curTid];
-    std::optional<Task<T>> task = queue.pop();
+    Lanes &queue = taskQueues[curTid];
+    LaneAging &aging = agings[curTid];
+    std::optional<Task<T>> task =
+        aging.take([&](int lane) -> std::optional<Task<T>> {
+          std::optional<Task<T>> found = queue[lane].pop();
+          // Work that was meant for us comes before anything else we could
+          // find
+          if (!found.has_value()) {
+            found = popMailbox(curTid, lane);
+          }
+          // Submitted roots come before random stealing
+          if (!found.has_value() && !injectionQueues[lane].empty()) {
+            found = injectionQueues[lane].pop();
+          }
+          return found;
+        });
 
     if (!task.has_value()) {
       size_t randomIndex = GetRandomTaskQueue();
@@ -117,12 +280,18 @@ public:
         return std::nullopt;
       }
 
-      TaskQueue<T> &randomQueue = taskQueues[randomIndex];
+      Lanes &randomQueue = taskQueues[randomIndex];
       if (&queue == &randomQueue) {
         std::this_thread::yield();
         return std::nullopt;
       }
-      task = randomQueue.steal();
+      task = aging.take([&](int lane) -> std::optional<Task<T>> {
+        std::optional<Task<T>> found = randomQueue[lane].steal();
+        if (!found.has_value()) {
+          found = popMailbox(randomIndex, lane);
+        }
+        return found;
+      });
       if (!task.has_value()) {
         std::this_thread::yield();
         return std::nullopt;
@@ -131,28 +300,44 @@ public:
     return std::move(task);
   }
 
+  int numWorkers() { return n; }
+
+  bool hasLocalWork() {
+    int tid = getTid();
+    if (tid < 0) {
+      return false;
+    }
+    for (const auto &lane : taskQueues[tid]) {
+      if (!lane.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   // Attempt to steal work while waiting on fut to finish
   T sync(std::future<T> fut) {
     int tid = getTid();
+    Backoff backoff;
+
+    // Threads outside the pool can't help, so they just block
+    if (tid < 0) {
+      return fut.get();
+    }
+
+    // Only look at the future again once one of our children has bumped our
+    // join counter, new work showed up or we ran a task ourselves. See
+    // ChildScheduler::sync.
+    std::atomic<uint32_t> &joins = joinCounters[tid].count;
+    uint32_t seen = joins.load(std::memory_order_acquire);
 
-    // While future is not valid, attempt to steal work
     while (fut.wait_for(std::chrono::milliseconds(0)) !=
            std::future_status::ready) {
-      bool foundTask = false;
-      Task<T> task;
-      std::optional<Task<T>> taskOpt = getTask(tid);
-      if (taskOpt.has_value()) {
-        task = std::move(taskOpt.value());
-        foundTask = true;
+      while (!runSyncTask(tid) &&
+             !parking.wait(backoff, joinCounters[tid], seen, taskCount)) {
       }
-      if (foundTask) {
-        taskCount.fetch_sub(1, std::memory_order_relaxed);
-      } else {
-        continue;
-      }
-
-      // There is a task to run. Execute it!
-      task.func();
+      backoff.reset();
+      seen = joins.load(std::memory_order_acquire);
     }
 
     // Return result of future if there is one
@@ -164,10 +349,104 @@ public:
   }
 
 private:
-  // Get the callling threads integer thread ID
-  int getTid() { return threadIds[std::this_thread::get_id()]; }
+  // Get the callling threads integer thread ID, or -1 if it is not one of
+  // our workers
+  int getTid() { return self.owner == this ? self.tid : -1; }
+
+  // Size the per-thread state for a pool of n threads
+  void setup(int n) {
+    this->n = n;
+    std::vector<JoinCounter> counters(n);
+    joinCounters.swap(counters);
+    agings.assign(n, LaneAging());
+    while (taskQueues.size() < static_cast<size_t>(n)) {
+      // emplace_back efficiently stores the queue without needing an extra
+      // move
+      taskQueues.emplace_back(Lanes{TaskQueue<T>(SIDE_LANE_CAPACITY),
+                                    TaskQueue<T>(),
+                                    TaskQueue<T>(SIDE_LANE_CAPACITY)});
+    }
+    while (mailboxes.size() < static_cast<size_t>(n * NUM_PRIORITIES)) {
+      mailboxes.push_back(
+          std::make_unique<InjectionQueue<Task<T>>>(MAILBOX_CAPACITY));
+    }
+  }
+
+  InjectionQueue<Task<T>> &mailbox(int tid, int lane) {
+    return *mailboxes[tid * NUM_PRIORITIES + lane];
+  }
+
+  std::optional<Task<T>> popMailbox(int tid, int lane) {
+    if (mailbox(tid, lane).empty()) {
+      return std::nullopt;
+    }
+    return mailbox(tid, lane).pop();
+  }
+
+  // Run task at its own priority and let its parent know it finished.
+  void execute(Task<T> &task) {
+    Priority prevPriority = self.priority;
+    self.priority = task.priority;
+    TaskGroup::runDetached(task.func);
+    self.priority = prevPriority;
+    signalParent(task);
+  }
+
+  // Let the thread that spawned task know it finished. Roots submitted from
+  // outside the pool have no parent to signal.
+  void signalParent(const Task<T> &task) {
+    if (task.parent >= 0) {
+      joinCounters[task.parent].signal();
+    }
+  }
+
+  // Wake sleeping workers because new work was queued, or because we are
+  // shutting down (force). Workers parked in sync are woken too.
+  void wake(bool force) {
+    if (force || sleepers.load(std::memory_order_seq_cst) > 0) {
+      wakeEpoch.fetch_add(1, std::memory_order_seq_cst);
+      wakeEpoch.notify_all();
+    }
+    parking.wake(joinCounters);
+  }
+
+  // Called by an idle worker of a persistent pool. Spins for a while and then
+  // sleeps until new work is queued. A worker only goes to sleep after
+  // announcing itself in sleepers and then seeing no queued tasks, while
+  // every producer counts its task before checking sleepers, so a wakeup
+  // can't be lost.
+  void idle(Backoff &backoff) {
+    if (!backoff.exhausted()) {
+      backoff.spin();
+      return;
+    }
+
+    sleepers.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t epoch = wakeEpoch.load(std::memory_order_seq_cst);
+    if (taskCount.load(std::memory_order_seq_cst) == 0 && !stopping) {
+      wakeEpoch.wait(epoch, std::memory_order_seq_cst);
+    }
+    sleepers.fetch_sub(1, std::memory_order_seq_cst);
+    backoff.reset();
+  }
+
+  // Try to take one task and run it. Returns false if no task was found.
+  bool runSyncTask(int tid) {
+    std::optional<Task<T>> taskOpt = getTask(tid);
+    if (!taskOpt.has_value()) {
+      return false;
+    }
+    taskCount.fetch_sub(1, std::memory_order_relaxed);
+
+    // There is a task to run. Execute it!
+    execute(taskOpt.value());
+    return true;
+  }
 
   void workerThread(int tid) {
+    self = WorkerId{this, tid};
+    Backoff backoff;
+
     // Loop continuously over all the work queues, starting with this thread's
     // queue If we find any work to do, pop the work off and complete it! This
     // naive way of finding work might cause a lot of contention!
@@ -187,16 +466,21 @@ private:
         // No more tasks across all queues AND no workers currently running a
         // task If a workers is running a task then it might add more tasks to
         // its queue, so we keep this thread runing
-        if (taskCount == 0 && workCount == 0) {
+        // A persistent pool only exits once stop() was called.
+        if (taskCount == 0 && workCount == 0 && (!persistent || stopping)) {
           break;
         }
 
         // Keep this thread running and check next queue
+        if (persistent) {
+          idle(backoff);
+        }
         continue;
       }
 
       // There is a task to run. Execute it!
-      task.func();
+      backoff.reset();
+      execute(task);
       //   delete task;
       workCount.fetch_sub(1, std::memory_order_relaxed);
     }
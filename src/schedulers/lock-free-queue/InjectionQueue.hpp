@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+// A bounded multi-producer multi-consumer queue (Dmitry Vyukov's design).
+// Every slot carries a sequence number that tells producers and consumers
+// whether it is free or full for their lap around the ring, so each side only
+// needs a single CAS on its own index and never touches the other side's.
+// Used by the schedulers to accept work from threads outside the pool.
+template <typename E> class InjectionQueue {
+public:
+  // capacity must be a power of two
+  explicit InjectionQueue(size_t capacity = 1 << 16)
+      : mask(capacity - 1), slots(new Slot[capacity]) {
+    for (size_t i = 0; i < capacity; i++) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    enqueueIndex.store(0, std::memory_order_relaxed);
+    dequeueIndex.store(0, std::memory_order_relaxed);
+  }
+
+  InjectionQueue(const InjectionQueue &) = delete;
+  InjectionQueue &operator=(const InjectionQueue &) = delete;
+
+  // Returns false if the queue is full
+  bool push(E &&elem) {
+    size_t pos = enqueueIndex.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots[pos & mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        // Slot is free for this lap, try to claim it
+        if (enqueueIndex.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // Slot still holds an element from the previous lap
+        return false;
+      } else {
+        pos = enqueueIndex.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->elem = std::move(elem);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns nullopt if the queue is empty
+  std::optional<E> pop() {
+    size_t pos = dequeueIndex.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots[pos & mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        // Slot is full for this lap, try to claim it
+        if (dequeueIndex.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;
+      } else {
+        pos = dequeueIndex.load(std::memory_order_relaxed);
+      }
+    }
+
+    std::optional<E> elem(std::move(slot->elem));
+    // Hand the slot back to producers for the next lap
+    slot->seq.store(pos + mask + 1, std::memory_order_release);
+    return elem;
+  }
+
+  // Cheap check so idle workers can skip the queue without a CAS. May be
+  // stale by the time the caller acts on it.
+  bool empty() const {
+    return dequeueIndex.load(std::memory_order_relaxed) >=
+           enqueueIndex.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> seq;
+    E elem;
+  };
+
+  const size_t mask;
+  std::unique_ptr<Slot[]> slots;
+  // Producers and consumers each get their own cache line
+  alignas(64) std::atomic<size_t> enqueueIndex;
+  alignas(64) std::atomic<size_t> dequeueIndex;
+};
@@ -4,6 +4,12 @@
 #include <functional>
 #include <future>
 
+#include "../priority.hpp"
+
 template <typename T> struct Task {
   std::packaged_task<T()> func;
+  // Thread that spawned this task and will eventually sync on it
+  int parent = 0;
+  // Lane the task was queued in
+  Priority priority = PRIORITY_NORMAL;
 };
\ No newline at end of file
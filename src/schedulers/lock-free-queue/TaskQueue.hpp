@@ -3,58 +3,75 @@
 #include "Task.hpp"
 #include <algorithm>
 #include <atomic>
+#include <memory>
 #include <optional>
 #include <vector>
 
 template <typename T> class TaskQueue {
 public:
-  TaskQueue() {
+  // capacity must be a power of two
+  explicit TaskQueue(int capacity = DEFAULT_CAPACITY)
+      : mask(capacity - 1), writable(new std::atomic_int[capacity]) {
     backIndex = 0;  // nothing in queue so initialze to 0
     frontIndex = 0; // nothing in queue so initialze to 0
-    queue.resize(100000);
+    queue.resize(capacity);
+    for (int i = 0; i < capacity; i++) {
+      writable[i].store(i, std::memory_order_relaxed);
+    }
   }
 
   TaskQueue(const TaskQueue &) = delete; // Disable copy constructor
   TaskQueue(TaskQueue &&other) noexcept
-      : backIndex(other.backIndex.load(std::memory_order_relaxed)),
-        frontIndex(other.frontIndex.load(std::memory_order_relaxed)),
-        queue(std::move(other.queue)) {}            // Allow move constructor
+      : mask(other.mask), queue(std::move(other.queue)),
+        writable(std::move(other.writable)),
+        backIndex(other.backIndex.load(std::memory_order_relaxed)),
+        frontIndex(other.frontIndex.load(
+            std::memory_order_relaxed)) {}          // Allow move constructor
   TaskQueue &operator=(const TaskQueue &) = delete; // Disable copy assignment
   TaskQueue &operator=(TaskQueue &&) = delete;      // Disable move assignment
 
   // This thread tries to pop from back of the queue and adds to back of the
-  // queue allowing for LF
+  // queue allowing for LF. The back index has to be claimed before looking at
+  // the front, otherwise a thief that read the old back can take the same
+  // task.
   std::optional<Task<T>> pop() {
-    int back = backIndex.load(std::memory_order_seq_cst);
-    if (back == 0)
-      return std::nullopt;
+    int back = backIndex.load(std::memory_order_relaxed) - 1;
+    backIndex.store(back, std::memory_order_seq_cst);
     int front = frontIndex.load(std::memory_order_seq_cst);
-    back = std::max(0, back - 1); // Error where it goes negative
-    backIndex.store(back, std::memory_order_seq_cst); // reupdate it
-    if (front <= back) {
-      Task<T> *task = &queue[back];
-      if (front != back) {
-        return std::move(*task);
-      }
-      // Try and update it, if not, report nullopt as it failed
-      if (frontIndex.compare_exchange_strong(front, front + 1,
-                                             std::memory_order_seq_cst)) {
-        backIndex.store(front + 1, std::memory_order_release);
-        return std::move(*task);
-      }
-      backIndex.store(front + 1, std::memory_order_release);
-      return std::nullopt;
-    } else {
-      backIndex.store(front, std::memory_order_seq_cst);
+    if (front > back) {
+      // Empty, undo the claim
+      backIndex.store(front, std::memory_order_relaxed);
       return std::nullopt;
     }
+
+    Task<T> *task = &queue[back & mask];
+    if (front != back) {
+      return std::move(*task);
+    }
+    // Last task, race thieves for it through the front index
+    int expected = front;
+    bool won = frontIndex.compare_exchange_strong(expected, front + 1,
+                                                  std::memory_order_seq_cst);
+    backIndex.store(front + 1, std::memory_order_relaxed);
+    if (won) {
+      return release(front);
+    }
+    return std::nullopt;
   }
   // This thread adds to back of queue to reduce contention and they steal from
-  // front
-  void push(Task<T> task) {
+  // front. Returns false and leaves task untouched if the queue is full.
+  bool push(Task<T> &&task) {
     int back = backIndex.load(std::memory_order_seq_cst);
-    queue[back] = std::move(task);
+    if (back - frontIndex.load(std::memory_order_seq_cst) > mask) {
+      return false;
+    }
+    // A thief that claimed this slot a lap ago may still be moving out of it
+    if (writable[back & mask].load(std::memory_order_acquire) != back) {
+      return false;
+    }
+    queue[back & mask] = std::move(task);
     backIndex.store(back + 1, std::memory_order_seq_cst);
+    return true;
   }
 
   // Steal from front of queue and try and steal it by using cmp_exchange
@@ -62,10 +79,9 @@ public:
     int front = frontIndex.load(std::memory_order_seq_cst);
     int back = backIndex.load(std::memory_order_seq_cst);
     if (front < back) {
-      Task<T> *task = &queue[front];
       if (frontIndex.compare_exchange_strong(front, front + 1,
                                              std::memory_order_seq_cst)) {
-        return std::move(*task);
+        return release(front);
       }
       // Did not successfully update the front index
       return std::nullopt;
@@ -74,8 +90,31 @@ public:
     }
   }
 
+  // May be stale by the time the caller acts on it
+  bool empty() const {
+    return frontIndex.load(std::memory_order_relaxed) >=
+           backIndex.load(std::memory_order_relaxed);
+  }
+
 private:
+  // The indices only ever grow as tasks get stolen, so the buffer is used as
+  // a ring. The capacity bounds how many tasks can be queued at once, not how
+  // many pass through the queue over its lifetime.
+  static constexpr int DEFAULT_CAPACITY = 1 << 17;
+  const int mask;
+
+  // Move out the task at index, which the caller claimed through the front
+  // index, and only then hand its slot to the push one lap later.
+  Task<T> release(int index) {
+    Task<T> task = std::move(queue[index & mask]);
+    writable[index & mask].store(index + mask + 1, std::memory_order_release);
+    return task;
+  }
+
   std::vector<Task<T>> queue; // the actual queue storing everything
+  // Index each slot may next be pushed at. Claiming a slot through the front
+  // index frees it before its task was moved out, so push checks this too.
+  std::unique_ptr<std::atomic_int[]> writable;
   std::atomic_int backIndex;  // Pointer for back index of the queue
   std::atomic_int frontIndex; // Pointer for the front index of the queue
 };
\ No newline at end of file
@@ -11,14 +11,20 @@ public:
 
   T run(std::function<T()> func, int n) { return func(); }
 
+  // Children run before the rest of their parent, which is already serial
+  // order, so reducers need no separate views here. Children of a cancelled
+  // group are still skipped.
   std::future<T> spawn(std::function<T()> func) {
     std::promise<T> prom;
     std::future<T> fut = prom.get_future();
-    prom.set_value(func());
+    prom.set_value(TaskGroup::wrap(std::move(func))());
     return fut;
   }
 
   T sync(std::future<T> fut) { return fut.get(); }
+
+  // Spawned work runs right away, so splitting a loop never pays off
+  bool hasLocalWork() { return true; }
 };
 
 #endif
\ No newline at end of file
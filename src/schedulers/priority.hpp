@@ -0,0 +1,76 @@
+/**
+ * @file priority.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Priority lanes for tasks. Schedulers that support priorities keep
+ * one deque per lane for every worker and look at higher lanes first, both
+ * when popping their own work and when stealing. To keep a steady stream of
+ * high priority work from starving the lower lanes, lanes that keep getting
+ * passed over age and are eventually tried first.
+ */
+
+#ifndef PRIORITY_HPP
+#define PRIORITY_HPP
+
+// Lower value means more urgent. Tasks spawned without a priority inherit the
+// priority of the task that spawned them.
+enum Priority {
+  PRIORITY_HIGH,
+  PRIORITY_NORMAL,
+  PRIORITY_LOW,
+  NUM_PRIORITIES,
+};
+
+// Per-worker aging state. Every time a worker takes a task, all lanes below
+// it count one more pass over. Once a lane has been passed over AGING_LIMIT
+// times it is tried before the higher lanes, so it gets at least one of every
+// AGING_LIMIT + 1 picks while it has work.
+struct alignas(64) LaneAging {
+  static constexpr int AGING_LIMIT = 8;
+  int passedOver[NUM_PRIORITIES] = {};
+
+  // Take a task from the best lane. take(lane) returns an optional task from
+  // that lane.
+  template <typename F> auto take(F take) -> decltype(take(0)) {
+    int starved = starvedLane();
+    if (starved >= 0) {
+      auto task = take(starved);
+      if (task.has_value()) {
+        took(starved);
+        return task;
+      }
+      // Nothing waiting in that lane after all
+      passedOver[starved] = 0;
+    }
+
+    for (int lane = 0; lane < NUM_PRIORITIES; lane++) {
+      auto task = take(lane);
+      if (task.has_value()) {
+        took(lane);
+        return task;
+      }
+    }
+    return {};
+  }
+
+private:
+  // Lowest lane that has aged past the limit, or -1
+  int starvedLane() const {
+    for (int lane = NUM_PRIORITIES - 1; lane > 0; lane--) {
+      if (passedOver[lane] >= AGING_LIMIT) {
+        return lane;
+      }
+    }
+    return -1;
+  }
+
+  void took(int lane) {
+    passedOver[lane] = 0;
+    for (int lower = lane + 1; lower < NUM_PRIORITIES; lower++) {
+      passedOver[lower]++;
+    }
+  }
+};
+
+#endif
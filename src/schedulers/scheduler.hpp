@@ -4,6 +4,11 @@
 #include <functional>
 #include <future>
 
+#include "affinity.hpp"
+#include "priority.hpp"
+#include "task_group.hpp"
+#include "views.hpp"
+
 // A generic thread scheduler. All schedulers we create share a common
 // interface, which makes testing easier. To create a scheduler, extend this
 // class and provide definitions for the virtual functions.
@@ -15,6 +20,29 @@ public:
   // Spawn new function to potentially be run in parallel.
   virtual std::future<T> spawn(std::function<T()> func) = 0;
 
+  // Spawn with an explicit priority. Schedulers without priority lanes treat
+  // every task the same.
+  virtual std::future<T> spawn(std::function<T()> func,
+                               Priority /*priority*/) {
+    return spawn(std::move(func));
+  }
+
+  // Spawn with a hint about which worker should run func. Schedulers without
+  // affinity support ignore the hint.
+  virtual std::future<T> spawn(std::function<T()> func,
+                               Affinity /*affinity*/) {
+    return spawn(std::move(func));
+  }
+
+  // Number of threads that can run spawned work at the same time
+  virtual int numWorkers() { return 1; }
+
+  // True if the calling thread's own queue holds tasks that other threads
+  // could steal. Parallel loops only split off more work when it doesn't.
+  // Schedulers that can't tell report false, so loops split all the way down
+  // to their grain size.
+  virtual bool hasLocalWork() { return false; }
+
   // While future is not valid, attempt to steal work
   virtual T sync(std::future<T> fut) = 0;
 };
@@ -16,6 +16,8 @@
 template <typename T> class SimpleScheduler : public Scheduler<T> {
 private:
   int threadsAvail;
+  // Size of the pool given to run
+  int n = 1;
   std::mutex mut;
 
 public:
@@ -23,12 +25,16 @@ public:
 
   T run(std::function<T()> func, int n) {
     threadsAvail = n;
+    this->n = n;
     return func();
   }
 
+  int numWorkers() { return n; }
+
   // Spawn a function to run "in parallel". If threadsAvail > 0, we can actually
   // run it in parallel Otherwise, run the function sequentially.
   std::future<T> spawn(std::function<T()> func) {
+    func = ViewFrame::wrap(TaskGroup::wrap(std::move(func)));
     std::promise<T> prom;
     std::future<T> fut = prom.get_future();
     bool runParallel = false;
@@ -0,0 +1,109 @@
+/**
+ * @file task_group.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Cooperative cancellation. Everything spawned, directly or not, while
+ * a TaskGroup runs a function belongs to that group. Once the group is
+ * cancelled its tasks that haven't started yet return right away without
+ * running their function, so they drain out of the queues as fast as they
+ * can be popped and syncs on them return promptly. Tasks that already run
+ * can poll TaskGroup::cancelled() and stop early.
+ *
+ * Schedulers call TaskGroup::wrap on every spawned function, inside the
+ * reducer frame (see views.hpp) so a skipped child still folds its views.
+ * Skipped tasks return a default constructed T. Like reducers, nothing is
+ * wrapped while no group exists, so schedulers run every task they take from
+ * a queue through TaskGroup::runDetached.
+ */
+
+#ifndef TASK_GROUP_HPP
+#define TASK_GROUP_HPP
+
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+class TaskGroup {
+private:
+  std::atomic<bool> cancelRequested = false;
+  // Group run() was called from. Cancelling it cancels this group too.
+  TaskGroup *parent;
+
+  // Number of groups alive. Spawns are only wrapped while this isn't 0.
+  static inline std::atomic<int> liveGroups = 0;
+  // Group of the strand the calling thread is running, if any
+  static inline thread_local TaskGroup *current = nullptr;
+
+  // Run func with group as the calling thread's group
+  template <typename F> static auto runIn(TaskGroup *group, F &&func) {
+    TaskGroup *saved = current;
+    current = group;
+    struct Restore {
+      TaskGroup *saved;
+      ~Restore() { current = saved; }
+    } restore{saved};
+    return func();
+  }
+
+public:
+  TaskGroup() : parent(current) {
+    liveGroups.fetch_add(1, std::memory_order_relaxed);
+  }
+  ~TaskGroup() { liveGroups.fetch_sub(1, std::memory_order_relaxed); }
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  // Run func as part of this group. Everything func spawns must be synced
+  // before it returns.
+  template <typename F> auto run(F &&func) {
+    return runIn(this, std::forward<F>(func));
+  }
+
+  // Stop the group. Safe to call from any thread, any number of times.
+  void cancel() { cancelRequested.store(true, std::memory_order_relaxed); }
+
+  bool isCancelled() const {
+    for (const TaskGroup *g = this; g != nullptr; g = g->parent) {
+      if (g->cancelRequested.load(std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether the group the calling strand belongs to was cancelled. Cheap
+  // enough to call once per node of a search.
+  static bool cancelled() {
+    return current != nullptr && current->isCancelled();
+  }
+
+  // Run a task the calling thread took from a queue. The task starts out in
+  // no group: wrapped tasks then enter their own, and tasks spawned while no
+  // group existed must not end up in the group of whatever strand the thread
+  // was running, e.g. one stealing while it waits in sync.
+  template <typename F> static auto runDetached(F &&task) {
+    return runIn(nullptr, std::forward<F>(task));
+  }
+
+  // Make a function spawned by the calling strand run in the strand's group,
+  // or not at all once that group is cancelled
+  template <typename T>
+  static std::function<T()> wrap(std::function<T()> func) {
+    if (liveGroups.load(std::memory_order_relaxed) == 0) {
+      return func;
+    }
+
+    TaskGroup *group = current;
+    return [func = std::move(func), group]() -> T {
+      if (group != nullptr && group->isCancelled()) {
+        return T();
+      }
+      return runIn(group, func);
+    };
+  }
+};
+
+#endif
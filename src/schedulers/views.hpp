@@ -0,0 +1,268 @@
+/**
+ * @file views.hpp
+ * @author Yonah Goldberg (ygoldber@andrew.cmu.edu)
+ * @author Jack Ellinger (jellinge@andrew.cmu.edu)
+ *
+ * @brief Bookkeeping behind reducer hyperobjects (see parallel/reducer.hpp).
+ * Every strand of execution keeps its own views of the reducers it touches,
+ * so updates never contend. A strand's frame remembers, in serial order, the
+ * runs of updates it made itself and the frames of the children it spawned.
+ * Folding a frame in that order gives the same result as running the program
+ * serially, no matter which thread ran which child.
+ *
+ * Schedulers call ViewFrame::wrap on every spawned function. Whether a child
+ * gets stolen is only known after the parent has moved on, so every spawn
+ * gets a frame, but views in it are only created when the child first
+ * touches a reducer. Nothing is wrapped while no reducer exists.
+ *
+ * Root tasks handed to a pool with run() or submit() may run on any worker,
+ * next to other roots, so schedulers give each of them its own frame with
+ * ViewFrame::wrapRoot. Code outside any task uses a frame per thread.
+ */
+
+#ifndef VIEWS_HPP
+#define VIEWS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Type erased reducer, see Reducer in parallel/reducer.hpp
+class ReducerBase {
+public:
+  virtual ~ReducerBase() {}
+
+  // A new view holding the identity
+  virtual void *createView() = 0;
+
+  // left = left op right, then destroy right
+  virtual void reduceViews(void *left, void *right) = 0;
+
+  virtual void destroyView(void *view) = 0;
+};
+
+class ViewFrame {
+private:
+  using Views = std::vector<std::pair<ReducerBase *, void *>>;
+
+  // Either a run of updates made by the strand itself, or a spawned child
+  struct Piece {
+    Views views;
+    std::shared_ptr<ViewFrame> child;
+  };
+
+  std::vector<Piece> pieces;
+  // Set once a child has finished and folded its frame into one piece
+  std::atomic<bool> done = false;
+
+  // Number of reducers alive. Spawns are only wrapped while this isn't 0.
+  static inline std::atomic<int> liveReducers = 0;
+  // Frame of the strand the calling thread is running, or nullptr for code
+  // that isn't running inside any task
+  static inline thread_local ViewFrame *current = nullptr;
+
+  // Frame for code outside any task. Each thread has its own, so threads
+  // submitting roots never share one.
+  static ViewFrame &root() {
+    static thread_local ViewFrame frame;
+    return frame;
+  }
+
+  static ViewFrame &frame() { return current != nullptr ? *current : root(); }
+
+  // left = left op right for every reducer, leaving right empty
+  static void merge(Views &left, Views &right) {
+    for (auto &[reducer, view] : right) {
+      auto it = std::find_if(left.begin(), left.end(), [reducer](auto &v) {
+        return v.first == reducer;
+      });
+      if (it == left.end()) {
+        left.emplace_back(reducer, view);
+      } else {
+        reducer->reduceViews(it->second, view);
+      }
+    }
+    right.clear();
+  }
+
+  // Take reducer's view out of views, or nullptr if it has none
+  static void *take(Views &views, ReducerBase *reducer) {
+    auto it = std::find_if(views.begin(), views.end(),
+                           [reducer](auto &v) { return v.first == reducer; });
+    if (it == views.end()) {
+      return nullptr;
+    }
+    void *view = it->second;
+    views.erase(it);
+    return view;
+  }
+
+  // Fold all pieces into one. Every child must have finished.
+  void collapse() {
+    Views all;
+    for (auto &piece : pieces) {
+      if (piece.child != nullptr) {
+        if (!piece.child->pieces.empty()) {
+          merge(all, piece.child->pieces.front().views);
+        }
+      } else {
+        merge(all, piece.views);
+      }
+    }
+    pieces.clear();
+    if (!all.empty()) {
+      pieces.push_back(Piece{std::move(all), nullptr});
+    }
+  }
+
+  // Drop what no longer holds any views, so a frame that outlives its
+  // children doesn't grow with every spawn
+  void prune() {
+    pieces.erase(
+        std::remove_if(pieces.begin(), pieces.end(),
+                       [](Piece &piece) {
+                         if (piece.child == nullptr) {
+                           return piece.views.empty();
+                         }
+                         return piece.child->done.load(
+                                    std::memory_order_acquire) &&
+                                (piece.child->pieces.empty() ||
+                                 piece.child->pieces.front().views.empty());
+                       }),
+        pieces.end());
+  }
+
+public:
+  ViewFrame() {}
+
+  ViewFrame(const ViewFrame &) = delete;
+  ViewFrame &operator=(const ViewFrame &) = delete;
+
+  ~ViewFrame() {
+    for (auto &piece : pieces) {
+      for (auto &[reducer, view] : piece.views) {
+        reducer->destroyView(view);
+      }
+    }
+  }
+
+  static void reducerCreated() { liveReducers++; }
+
+  static void reducerDestroyed(ReducerBase *reducer) {
+    void *view = takeView(reducer);
+    if (view != nullptr) {
+      reducer->destroyView(view);
+    }
+    if (--liveReducers == 0) {
+      root().pieces.clear();
+    }
+  }
+
+  // The calling strand's view of reducer, created on first use
+  static void *view(ReducerBase *reducer) {
+    ViewFrame &f = frame();
+    if (f.pieces.empty() || f.pieces.back().child != nullptr) {
+      f.pieces.emplace_back();
+    }
+    Views &views = f.pieces.back().views;
+    for (auto &[owner, view] : views) {
+      if (owner == reducer) {
+        return view;
+      }
+    }
+    void *view = reducer->createView();
+    views.emplace_back(reducer, view);
+    return view;
+  }
+
+  // Fold reducer's views from the calling strand and its finished children,
+  // in serial order, and hand the result to the caller. Children that are
+  // still running are skipped, so sync every child that touched reducer
+  // first. Returns nullptr if there were no updates.
+  static void *takeView(ReducerBase *reducer) {
+    ViewFrame &f = frame();
+    void *result = nullptr;
+    for (auto &piece : f.pieces) {
+      Views *views = &piece.views;
+      if (piece.child != nullptr) {
+        if (!piece.child->done.load(std::memory_order_acquire) ||
+            piece.child->pieces.empty()) {
+          continue;
+        }
+        views = &piece.child->pieces.front().views;
+      }
+
+      void *view = take(*views, reducer);
+      if (view == nullptr) {
+        continue;
+      }
+      if (result == nullptr) {
+        result = view;
+      } else {
+        reducer->reduceViews(result, view);
+      }
+    }
+
+    f.prune();
+    return result;
+  }
+
+  // Give a function spawned by the calling strand its own frame, placed
+  // after everything the strand did so far. A child must be synced before
+  // its parent returns, like Cilk's implicit sync.
+  template <typename T>
+  static std::function<T()> wrap(std::function<T()> func) {
+    if (liveReducers.load(std::memory_order_relaxed) == 0) {
+      return func;
+    }
+
+    auto child = std::make_shared<ViewFrame>();
+    frame().pieces.push_back(Piece{Views(), child});
+    return enter(std::move(func), std::move(child));
+  }
+
+  // Give a root task its own frame. While reducers exist the frame is placed
+  // in the calling strand's frame like a spawn, so the caller sees the
+  // root's updates once it has synced the root. A thread that keeps
+  // submitting roots may never read a reducer, so finished roots that left
+  // nothing behind are dropped first.
+  template <typename T>
+  static std::function<T()> wrapRoot(std::function<T()> func) {
+    if (liveReducers.load(std::memory_order_relaxed) != 0) {
+      frame().prune();
+      return wrap(std::move(func));
+    }
+    return enter(std::move(func), std::make_shared<ViewFrame>());
+  }
+
+private:
+  // Run func as the strand of child
+  template <typename T>
+  static std::function<T()> enter(std::function<T()> func,
+                                  std::shared_ptr<ViewFrame> child) {
+    return [func = std::move(func), child = std::move(child)]() -> T {
+      ViewFrame *parent = current;
+      current = child.get();
+      auto finish = [&] {
+        child->collapse();
+        child->done.store(true, std::memory_order_release);
+        current = parent;
+      };
+
+      if constexpr (std::is_void<T>::value) {
+        func();
+        finish();
+      } else {
+        T res = func();
+        finish();
+        return res;
+      }
+    };
+  }
+};
+
+#endif
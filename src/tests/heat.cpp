@@ -22,6 +22,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <algorithm>
 #include <chrono>
 #include <errno.h>
 #include <fcntl.h>
@@ -29,8 +30,11 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
+#include "../parallel/parallel_for.hpp"
+#include "../parallel/parallel_reduce.hpp"
 #include "../scheduler_instance.hpp"
 #include "heat.hpp"
 
@@ -46,138 +50,27 @@ extern int errno;
 #define randd(y, t) (exp(-2 * (t)) * sin(y))
 #define solu(x, y, t) (exp(-2 * (t)) * sin(x) * sin(y))
 
-/* apparently register storage specifier is deprecated */
-#define register
-
-int nx, ny, nt;
-double xu, xo, yu, yo, tu, to;
-double dx, dy, dt;
-
-double dtdxsq, dtdysq;
-double t;
-
-int leafmaxcol;
-
-/*****************   Allocation of grid partition  ********************/
-
-void allcgrid(double **neww, double **old, int lb, int ub) {
-
-  int j;
-  double **rne, **rol;
-
-  for (j = lb, rol = old + lb, rne = neww + lb; j < ub; j++, rol++, rne++) {
-    *rol = (double *)malloc(ny * sizeof(double));
-    *rne = (double *)malloc(ny * sizeof(double));
-  }
-}
-
-/*****************   Initialization of grid partition  ********************/
-
-void initgrid(double **old, int lb, int ub) {
-
-  int a, b, llb, lub;
-
-  llb = (lb == 0) ? 1 : lb;
-  lub = (ub == nx) ? nx - 1 : ub;
-
-  for (a = llb, b = 0; a < lub; a++) /* boundary nodes */
-    old[a][b] = randa(xu + a * dx, 0);
-
-  for (a = llb, b = ny - 1; a < lub; a++)
-    old[a][b] = randb(xu + a * dx, 0);
-
-  if (lb == 0) {
-    for (a = 0, b = 0; b < ny; b++)
-      old[a][b] = randc(yu + b * dy, 0);
-  }
-  if (ub == nx) {
-    for (a = nx - 1, b = 0; b < ny; b++)
-      old[a][b] = randd(yu + b * dy, 0);
-  }
-  for (a = llb; a < lub; a++) { /* inner nodes */
-    for (b = 1; b < ny - 1; b++) {
-      old[a][b] = f(xu + a * dx, yu + b * dy);
-    }
-  }
-}
-
-/***************** Five-Point-Stencil Computation ********************/
-
-void compstripe(register double **neww, register double **old, int lb, int ub) {
-
-  register int a, b, llb, lub;
-
-  llb = (lb == 0) ? 1 : lb;
-  lub = (ub == nx) ? nx - 1 : ub;
-
-  for (a = llb; a < lub; a++) {
-    for (b = 1; b < ny - 1; b++) {
-      neww[a][b] = dtdxsq * (old[a + 1][b] - 2 * old[a][b] + old[a - 1][b]) +
-                   dtdysq * (old[a][b + 1] - 2 * old[a][b] + old[a][b - 1]) +
-                   old[a][b];
-    }
-  }
-
-  for (a = llb, b = ny - 1; a < lub; a++)
-    neww[a][b] = randb(xu + a * dx, t);
-
-  for (a = llb, b = 0; a < lub; a++)
-    neww[a][b] = randa(xu + a * dx, t);
-
-  if (lb == 0) {
-    for (a = 0, b = 0; b < ny; b++)
-      neww[a][b] = randc(yu + b * dy, t);
-  }
-  if (ub == nx) {
-    for (a = nx - 1, b = 0; b < ny; b++)
-      neww[a][b] = randd(yu + b * dy, t);
-  }
-}
-
-/***************** Decomposition of 2D grids in stripes ********************/
-
-#define ALLC 0
-#define INIT 1
-#define COMP 2
-
-int divide(int lb, int ub, double **neww, double **old, int mode,
-           int timestep) {
-
-  if (ub - lb > leafmaxcol) {
-    int _tmp;
-    int r;
-    auto fut = scheduler->spawn(
-        [=]() { return divide(lb, (ub + lb) / 2, neww, old, mode, timestep); });
-    r = divide((ub + lb) / 2, ub, neww, old, mode, timestep);
-    int l = scheduler->sync(std::move(fut));
-
-    _tmp = l + r;
-    return _tmp;
-
-  } else {
-    switch (mode) {
-    case COMP:
-      if (timestep % 2)
-        compstripe(neww, old, lb, ub);
-      else
-        compstripe(old, neww, lb, ub);
-      return 1;
-
-    case ALLC:
-      allcgrid(neww, old, lb, ub);
-      return 1;
-
-    case INIT:
-      initgrid(old, lb, ub);
-      return 1;
-    }
-
-    return 0;
-  }
+/*****************   Boundary conditions  ********************/
+
+double HeatBoundary::operator()(const std::array<long, 2> &i,
+                                int timestep) const {
+  /* The initial condition is taken at time 0 */
+  double t = timestep == 0 ? 0.0 : tu + timestep * dt;
+  long a = i[0], b = i[1];
+
+  if (a == 0)
+    return randc(yu + b * dy, t);
+  if (a == nx - 1)
+    return randd(yu + b * dy, t);
+  if (b == 0)
+    return randa(xu + a * dx, t);
+  return randb(xu + a * dx, t);
 }
 
-int heat(int nxX, int nyX, int ntX, double xuX, double xoX, double yuX,
-         double yoX, double tuX, double toX, int leftmaxcolX) {
+HeatSolver::HeatSolver(int nxX, int nyX, int ntX, double xuX, double xoX,
+                       double yuX, double yoX, double tuX, double toX,
+                       int leftmaxcolX, bool affinityX,
+                       LoopSchedule scheduleX, HeatMode modeX) {
   nx = nxX;
   ny = nyX;
   nt = ntX;
@@ -188,6 +81,9 @@ int heat(int nxX, int nyX, int ntX, double xuX, double xoX, double yuX,
   tu = tuX;
   to = toX;
   leafmaxcol = leftmaxcolX;
+  useAffinity = affinityX;
+  loopSchedule = scheduleX;
+  heatMode = modeX;
 
   dx = (xo - xu) / (nx - 1);
   dy = (yo - yu) / (ny - 1);
@@ -195,72 +91,85 @@ int heat(int nxX, int nyX, int ntX, double xuX, double xoX, double yuX,
 
   dtdxsq = dt / (dx * dx);
   dtdysq = dt / (dy * dy);
+}
 
-  leafmaxcol = leftmaxcolX;
+double HeatSolver::at(int a, int b) const {
+  return stencil->grid()[{a, b}];
+}
 
-  double **old, **neww;
-  int c, l;
+double HeatSolver::busySeconds() const { return stencil->busySeconds(); }
+
+int HeatSolver::run() {
 #ifdef ERROR_SUMMARY
-  double tmp, **mat;
   double mae = 0.0;
   double mre = 0.0;
   double me = 0.0;
-  int a, b;
 #endif
 
-  /* Memory Allocation */
-  old = (double **)malloc(nx * sizeof(double *));
-  neww = (double **)malloc(nx * sizeof(double *));
-
-  l = divide(0, nx, neww, old, ALLC, 0);
-  /*
-   * Sequential allocation might be faster than parallel!
-   * Substitute the following call for the preceding divide:
-   *
-   * allcgrid(new, old, 0, nx);
-   */
-
-  /* Initialization */
-  // l = divide(0, nx, new, old, INIT, 0);
+  /* Memory Allocation, first touched in parallel by the first init. Later
+   * runs reuse it. */
+  if (!stencil) {
+    StencilOptions options;
+    options.tile = leafmaxcol;
+    options.schedule = loopSchedule;
+    options.affinity = useAffinity;
+    options.mode = heatMode == HEAT_TRAPEZOID  ? STENCIL_TRAPEZOID
+                   : heatMode == HEAT_DATAFLOW ? STENCIL_DATAFLOW
+                                               : STENCIL_SWEEP;
+    options.timeTiles = timing;
+    stencil.reset(new Grid({nx, ny}, FivePoint2D<double>{dtdxsq, dtdysq},
+                        HeatBoundary{nx, ny, xu, yu, dx, dy, tu, dt},
+                        options));
+  }
 
   /* Jacobi Iteration (divide x-dimension of 2D grid into stripes) */
 
-  l = divide(0, nx, neww, old, INIT, 0);
-
-  for (c = 1; c <= nt; c++) {
-    t = tu + c * dt;
-    l = divide(0, nx, neww, old, COMP, c);
-  }
+  stencil->init([this](const std::array<long, 2> &i) {
+    return f(xu + i[0] * dx, yu + i[1] * dy);
+  });
+  auto start = std::chrono::steady_clock::now();
+  stencil->run(nt);
+  steps = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                        start)
+              .count();
 
 #ifdef ERROR_SUMMARY
-  /* Error summary computation: Not parallelized! */
-  mat = (c % 2) ? old : neww;
+  /* Error summary computation, one row per leaf of the reductions */
+  auto maxOp = [](double x, double y) { return std::max(x, y); };
+  auto sumOp = [](double x, double y) { return x + y; };
+  auto absError = [this](int a, int b) {
+    return fabs(at(a, b) - solu(xu + a * dx, yu + b * dy, to));
+  };
+  auto relError = [this, absError](int a, int b) {
+    double tmp = absError(a, b);
+    return at(a, b) != 0.0 ? tmp / at(a, b) : tmp;
+  };
+
   printf("\n Error summary of last time frame comparing with exact solution:");
-  for (a = 0; a < nx; a++)
-    for (b = 0; b < ny; b++) {
-      tmp = fabs(mat[a][b] - solu(xu + a * dx, yu + b * dy, to));
-      if (tmp > mae)
-        mae = tmp;
-    }
+  mae = parallel_transform_reduce(0, nx, 0.0, maxOp, [&](int a) {
+    double row = 0.0;
+    for (int b = 0; b < ny; b++)
+      row = std::max(row, absError(a, b));
+    return row;
+  }, 1);
 
   printf("\n   Local maximal absolute error  %10e ", mae);
 
-  for (a = 0; a < nx; a++)
-    for (b = 0; b < ny; b++) {
-      tmp = fabs(mat[a][b] - solu(xu + a * dx, yu + b * dy, to));
-      if (mat[a][b] != 0.0)
-        tmp = tmp / mat[a][b];
-      if (tmp > mre)
-        mre = tmp;
-    }
+  mre = parallel_transform_reduce(0, nx, 0.0, maxOp, [&](int a) {
+    double row = 0.0;
+    for (int b = 0; b < ny; b++)
+      row = std::max(row, relError(a, b));
+    return row;
+  }, 1);
 
   printf("\n   Local maximal relative error  %10e %s ", mre * 100, "%");
 
-  me = 0.0;
-  for (a = 0; a < nx; a++)
-    for (b = 0; b < ny; b++) {
-      me += fabs(mat[a][b] - solu(xu + a * dx, yu + b * dy, to));
-    }
+  me = parallel_transform_reduce(0, nx, 0.0, sumOp, [&](int a) {
+    double row = 0.0;
+    for (int b = 0; b < ny; b++)
+      row += absError(a, b);
+    return row;
+  }, 1);
 
   me = me / (nx * ny);
   printf("\n   Global Mean absolute error    %10e\n\n", me);
@@ -268,3 +177,11 @@ int heat(int nxX, int nyX, int ntX, double xuX, double xoX, double yuX,
 
   return 0;
 }
+
+int heat(int nxX, int nyX, int ntX, double xuX, double xoX, double yuX,
+         double yoX, double tuX, double toX, int leftmaxcolX,
+         bool affinityX, LoopSchedule scheduleX, HeatMode modeX) {
+  HeatSolver solver(nxX, nyX, ntX, xuX, xoX, yuX, yoX, tuX, toX, leftmaxcolX,
+                    affinityX, scheduleX, modeX);
+  return solver.run();
+}
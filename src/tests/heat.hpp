@@ -1,2 +1,82 @@
+#include <memory>
+
+#include "../parallel/parallel_for.hpp"
+#include "../parallel/stencil.hpp"
+
+// How heat walks through the timesteps, see StencilMode
+enum HeatMode {
+  // Every timestep sweeps the whole grid in stripes
+  HEAT_SWEEP,
+  // Cache oblivious trapezoids that cover several timesteps at once
+  HEAT_TRAPEZOID,
+  // Stripes run ahead of their neighbours without a barrier per timestep
+  HEAT_DATAFLOW,
+};
+
+// Temperatures on the edges of the grid, see randa to randd in heat.cpp
+struct HeatBoundary {
+  int nx, ny;
+  double xu, yu, dx, dy, tu, dt;
+
+  double operator()(const std::array<long, 2> &i, int timestep) const;
+};
+
+// Heat diffusion on an nx x ny grid over nt timesteps. A solver owns its
+// parameters and grids and keeps no global state, so several can run at once
+// on one scheduler. The grids are allocated on the first run, reused by later
+// runs and freed with the solver. Timesteps are 5 point stencils on
+// parallel/stencil.hpp, with stripes of rows as its tiles.
+class HeatSolver {
+public:
+  HeatSolver(int nxX, int nyX, int ntX, double xuX, double xoX, double yuX,
+             double yoX, double tuX, double toX, int leftmaxcolX,
+             bool affinityX = false, LoopSchedule scheduleX = SCHEDULE_LAZY,
+             HeatMode modeX = HEAT_SWEEP);
+
+  HeatSolver(const HeatSolver &) = delete;
+  HeatSolver &operator=(const HeatSolver &) = delete;
+
+  // Simulate all timesteps from the initial condition. Must be called from
+  // a task of the scheduler.
+  int run();
+
+  // Temperature at row a and column b after the last run
+  double at(int a, int b) const;
+
+  // Time the stripes from the first run on, see busySeconds. Call before
+  // the first run.
+  void timeStripes() { timing = true; }
+
+  // CPU time workers spent computing stripes in the last run, summed over
+  // workers
+  double busySeconds() const;
+
+  // Wall clock time of the timesteps of the last run, without the
+  // initialization
+  double stepSeconds() const { return steps; }
+
+private:
+  typedef Stencil<double, 2, FivePoint2D<double>, HeatBoundary> Grid;
+
+  int nx, ny, nt;
+  double xu, xo, yu, yo, tu, to;
+  double dx, dy, dt;
+  double dtdxsq, dtdysq;
+  // Rows per stripe
+  int leafmaxcol;
+  // Send every stripe to the same worker on every timestep
+  bool useAffinity;
+  // How stripes are handed out
+  LoopSchedule loopSchedule;
+  HeatMode heatMode;
+  bool timing = false;
+  double steps = 0.0;
+
+  std::unique_ptr<Grid> stencil;
+};
+
+// Run one simulation with a solver of its own
 int heat(int nxX, int nyX, int ntX, double xuX, double xoX, double yuX,
-         double yoX, double tuX, double toX, int leftmaxcolX);
\ No newline at end of file
+         double yoX, double tuX, double toX, int leftmaxcolX,
+         bool affinityX = false, LoopSchedule scheduleX = SCHEDULE_LAZY,
+         HeatMode modeX = HEAT_SWEEP);
\ No newline at end of file
@@ -1,7 +1,14 @@
 #include "nbody.hpp"
+#include "../parallel/parallel_for.hpp"
+#include "../parallel/parallel_reduce.hpp"
+#include "../parallel/sample_sort.hpp"
 #include "../scheduler_instance.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 // Function to calculate the Euclidean distance between two points
@@ -54,28 +61,289 @@ void updatePosition(Particle &particle) {
 }
 
 // Function to simulate the N-body problem
-void simulateNBody(std::vector<Particle> &particles) {
-  std::vector<std::future<int>> futures1;
-  for (size_t i = 0; i < particles.size(); ++i) {
-    auto fut = scheduler->spawn([i, &particles]() {
-      updateVelocity(particles[i], particles);
-      return 0;
-    });
-    futures1.push_back(std::move(fut));
+void simulateNBody(std::vector<Particle> &particles, LoopSchedule schedule) {
+  parallel_for(
+      size_t(0), particles.size(),
+      [&particles](size_t i) { updateVelocity(particles[i], particles); },
+      schedule);
+
+  parallel_for(
+      size_t(0), particles.size(),
+      [&particles](size_t i) { updatePosition(particles[i]); }, schedule);
+}
+
+/******************************* Barnes-Hut *******************************/
+
+// Quadtree leaves hold at most this many bodies
+const size_t BH_LEAF = 8;
+// Subtrees with more bodies than this are built in parallel
+const size_t BH_PARALLEL_CUTOFF = 4096;
+// Bits per coordinate in a Morton code, and so the depth of the tree
+const int BH_BITS = 32;
+
+// Position and mass of a particle, in Morton order
+struct Body {
+  double x, y, mass;
+};
+
+struct QuadNode {
+  // Side of the square the node covers
+  double size;
+  double mass, comX, comY;
+  // The node's bodies, consecutive in Morton order
+  size_t begin, end;
+  bool leaf;
+  // Quadrants by Morton order, empty ones are null
+  std::unique_ptr<QuadNode> children[4];
+};
+
+// Spread the bits of v apart so a zero sits between any two of them
+static uint64_t spread_bits(uint32_t v) {
+  uint64_t x = v;
+  x = (x | x << 16) & 0x0000FFFF0000FFFFULL;
+  x = (x | x << 8) & 0x00FF00FF00FF00FFULL;
+  x = (x | x << 4) & 0x0F0F0F0F0F0F0F0FULL;
+  x = (x | x << 2) & 0x3333333333333333ULL;
+  x = (x | x << 1) & 0x5555555555555555ULL;
+  return x;
+}
+
+// Mass and centre of mass of bodies [begin, end)
+static void summarize_bodies(QuadNode *node, const std::vector<Body> &bodies) {
+  double m = 0.0, mx = 0.0, my = 0.0;
+  for (size_t i = node->begin; i < node->end; i++) {
+    m += bodies[i].mass;
+    mx += bodies[i].mass * bodies[i].x;
+    my += bodies[i].mass * bodies[i].y;
   }
-  for (auto &fut : futures1) {
-    scheduler->sync(std::move(fut));
+  node->mass = m;
+  node->comX = mx / m;
+  node->comY = my / m;
+}
+
+// Build the subtree of bodies [begin, end), which share the top 2 * level
+// bits of their codes, and compute the mass and centre of mass of every node
+// on the way back up. Large subtrees build their quadrants in parallel.
+static std::unique_ptr<QuadNode> build_tree(const std::vector<Body> &bodies,
+                                            const std::vector<uint64_t> &codes,
+                                            size_t begin, size_t end,
+                                            int level, double size) {
+  std::unique_ptr<QuadNode> node(new QuadNode());
+  node->size = size;
+  node->begin = begin;
+  node->end = end;
+  node->leaf = end - begin <= BH_LEAF || level == BH_BITS;
+  if (node->leaf) {
+    summarize_bodies(node.get(), bodies);
+    return node;
   }
 
-  std::vector<std::future<int>> futures2;
-  for (size_t i = 0; i < particles.size(); ++i) {
-    auto fut = scheduler->spawn([i, &particles]() {
-      updatePosition(particles[i]);
+  // Codes are sorted, so each quadrant is a range
+  int shift = 2 * (BH_BITS - 1 - level);
+  size_t cut[5] = {begin, 0, 0, 0, end};
+  for (int q = 1; q < 4; q++) {
+    cut[q] = std::partition_point(codes.begin() + cut[q - 1],
+                                  codes.begin() + end,
+                                  [=](uint64_t code) {
+                                    return (int)((code >> shift) & 3) < q;
+                                  }) -
+             codes.begin();
+  }
+
+  bool parallel = end - begin > BH_PARALLEL_CUTOFF;
+  std::vector<std::future<int>> futures;
+  for (int q = 0; q < 4; q++) {
+    if (cut[q] == cut[q + 1]) {
+      continue;
+    }
+    auto child = [&, q] {
+      node->children[q] = build_tree(bodies, codes, cut[q], cut[q + 1],
+                                     level + 1, size / 2);
       return 0;
-    });
-    futures2.push_back(std::move(fut));
+    };
+    if (parallel) {
+      futures.push_back(scheduler->spawn(child));
+    } else {
+      child();
+    }
   }
-  for (auto &fut : futures2) {
+  for (auto &fut : futures) {
     scheduler->sync(std::move(fut));
   }
-}
\ No newline at end of file
+
+  double m = 0.0, mx = 0.0, my = 0.0;
+  for (auto &child : node->children) {
+    if (child) {
+      m += child->mass;
+      mx += child->mass * child->comX;
+      my += child->mass * child->comY;
+    }
+  }
+  node->mass = m;
+  node->comX = mx / m;
+  node->comY = my / m;
+  return node;
+}
+
+// Add the acceleration node exerts on body i to (ax, ay). Returns the
+// number of interactions.
+static long long accelerate(const QuadNode *node,
+                            const std::vector<Body> &bodies, size_t i,
+                            double thetaSq, double &ax, double &ay) {
+  double G = 6.674 * pow(10, -11); // gravitational constant
+  const Body &b = bodies[i];
+
+  if (node->leaf) {
+    for (size_t j = node->begin; j < node->end; j++) {
+      if (j != i) {
+        double dx = bodies[j].x - b.x;
+        double dy = bodies[j].y - b.y;
+        double distSq = dx * dx + dy * dy;
+        double a = G * bodies[j].mass / (distSq * sqrt(distSq));
+        ax += a * dx;
+        ay += a * dy;
+      }
+    }
+    return node->end - node->begin - (node->begin <= i && i < node->end);
+  }
+
+  // A cell never stands in for the body itself
+  double dx = node->comX - b.x;
+  double dy = node->comY - b.y;
+  double distSq = dx * dx + dy * dy;
+  bool inside = node->begin <= i && i < node->end;
+  if (!inside && node->size * node->size < thetaSq * distSq) {
+    double a = G * node->mass / (distSq * sqrt(distSq));
+    ax += a * dx;
+    ay += a * dy;
+    return 1;
+  }
+
+  long long interactions = 0;
+  for (auto &child : node->children) {
+    if (child) {
+      interactions += accelerate(child.get(), bodies, i, thetaSq, ax, ay);
+    }
+  }
+  return interactions;
+}
+
+struct BoundingBox {
+  double minX, minY, maxX, maxY;
+};
+
+// Accelerations of all particles from a Barnes-Hut quadtree. Returns the
+// number of interactions.
+static long long barnes_hut(const std::vector<Particle> &particles,
+                            double theta, LoopSchedule schedule,
+                            std::vector<Vector2D> &acc) {
+  size_t n = particles.size();
+  if (n == 0) {
+    return 0;
+  }
+
+  BoundingBox box = parallel_transform_reduce(
+      size_t(0), n,
+      BoundingBox{INFINITY, INFINITY, -INFINITY, -INFINITY},
+      [](const BoundingBox &a, const BoundingBox &b) {
+        return BoundingBox{std::min(a.minX, b.minX), std::min(a.minY, b.minY),
+                           std::max(a.maxX, b.maxX), std::max(a.maxY, b.maxY)};
+      },
+      [&particles](size_t i) {
+        const Vector2D &p = particles[i].position;
+        return BoundingBox{p.x, p.y, p.x, p.y};
+      });
+  double size = std::max(box.maxX - box.minX, box.maxY - box.minY);
+  if (size == 0.0) {
+    size = 1.0;
+  }
+
+  // Sort the particles along the Morton curve, so every node of the tree is
+  // a range of them and neighbours in space are neighbours in memory
+  std::vector<std::pair<uint64_t, size_t>> keyed(n);
+  double scale = ldexp(1.0, BH_BITS) / size;
+  double maxCell = ldexp(1.0, BH_BITS) - 1;
+  parallel_for(
+      size_t(0), n,
+      [&](size_t i) {
+        const Vector2D &p = particles[i].position;
+        uint32_t cx = std::min((p.x - box.minX) * scale, maxCell);
+        uint32_t cy = std::min((p.y - box.minY) * scale, maxCell);
+        keyed[i] = {spread_bits(cx) | spread_bits(cy) << 1, i};
+      },
+      schedule);
+  parallel_sample_sort(keyed.begin(), keyed.end());
+
+  std::vector<uint64_t> codes(n);
+  std::vector<Body> bodies(n);
+  parallel_for(
+      size_t(0), n,
+      [&](size_t k) {
+        const Particle &p = particles[keyed[k].second];
+        codes[k] = keyed[k].first;
+        bodies[k] = Body{p.position.x, p.position.y, p.mass};
+      },
+      schedule);
+
+  std::unique_ptr<QuadNode> root = build_tree(bodies, codes, 0, n, 0, size);
+
+  // Walk the tree for every body, in Morton order so consecutive walks go
+  // through mostly the same nodes
+  double thetaSq = theta * theta;
+  return parallel_transform_reduce(
+      size_t(0), n, 0LL, [](long long a, long long b) { return a + b; },
+      [&](size_t k) {
+        double ax = 0.0, ay = 0.0;
+        long long interactions =
+            accelerate(root.get(), bodies, k, thetaSq, ax, ay);
+        acc[keyed[k].second] = Vector2D(ax, ay);
+        return interactions;
+      });
+}
+
+long long simulateNBodyBarnesHut(std::vector<Particle> &particles,
+                                 double theta, LoopSchedule schedule) {
+  std::vector<Vector2D> acc(particles.size(), Vector2D(0.0, 0.0));
+  long long interactions = barnes_hut(particles, theta, schedule, acc);
+
+  double dt = 0.1; // time step
+  parallel_for(
+      size_t(0), particles.size(),
+      [&](size_t i) {
+        particles[i].velocity.x += acc[i].x * dt;
+        particles[i].velocity.y += acc[i].y * dt;
+        updatePosition(particles[i]);
+      },
+      schedule);
+  return interactions;
+}
+
+double nbodyBarnesHutError(const std::vector<Particle> &particles,
+                           double theta) {
+  std::vector<Vector2D> acc(particles.size(), Vector2D(0.0, 0.0));
+  barnes_hut(particles, theta, SCHEDULE_LAZY, acc);
+
+  struct Sums {
+    double error, norm;
+  };
+  Sums sums = parallel_transform_reduce(
+      size_t(0), particles.size(), Sums{0.0, 0.0},
+      [](const Sums &a, const Sums &b) {
+        return Sums{a.error + b.error, a.norm + b.norm};
+      },
+      [&](size_t i) {
+        // Direct sum, as in updateVelocity
+        double fx = 0.0, fy = 0.0;
+        for (const auto &other : particles) {
+          if (&particles[i] != &other) {
+            Vector2D f = calculateForce(particles[i], other);
+            fx += f.x;
+            fy += f.y;
+          }
+        }
+        double ax = fx / particles[i].mass, ay = fy / particles[i].mass;
+        double ex = acc[i].x - ax, ey = acc[i].y - ay;
+        return Sums{ex * ex + ey * ey, ax * ax + ay * ay};
+      });
+  return sqrt(sums.error / sums.norm);
+}
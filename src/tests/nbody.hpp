@@ -1,5 +1,7 @@
 #include <vector>
 
+#include "../parallel/parallel_for.hpp"
+
 // Structure to represent a 2D vector
 struct Vector2D {
   double x, y;
@@ -17,4 +19,19 @@ struct Particle {
       : position(x, y), velocity(vx, vy), mass(m) {}
 };
 
-void simulateNBody(std::vector<Particle> &particles);
\ No newline at end of file
+void simulateNBody(std::vector<Particle> &particles,
+                   LoopSchedule schedule = SCHEDULE_LAZY);
+
+// One timestep like simulateNBody, but with the forces of a Barnes-Hut
+// quadtree in O(n log n). A cell whose side is less than theta times its
+// distance from a particle acts on it as one body at the cell's centre of
+// mass. theta = 0 opens every cell, i.e. sums over all pairs. Returns the
+// number of interactions computed, with particles and with cells.
+long long simulateNBodyBarnesHut(std::vector<Particle> &particles,
+                                 double theta = 0.5,
+                                 LoopSchedule schedule = SCHEDULE_LAZY);
+
+// Error of the Barnes-Hut accelerations against summing over all pairs:
+// the root mean square of the error over that of the accelerations
+double nbodyBarnesHutError(const std::vector<Particle> &particles,
+                           double theta);
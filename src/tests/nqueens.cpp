@@ -1,46 +1,138 @@
 #include "nqueens.hpp"
+#include "../parallel/parallel_for.hpp"
+#include "../parallel/reducer.hpp"
 #include "../scheduler_instance.hpp"
 
-int ok(int n, char *a) {
-  int i, j;
-  char p, q;
+#include <array>
+#include <atomic>
 
-  for (i = 0; i < n; i++) {
-    p = a[i];
-    for (j = i + 1; j < n; j++) {
-      q = a[j];
-      if (q == p || q == p - (j - i) || q == p + (j - i))
-        return 0;
-    }
+// The board is kept as three bitmasks with one bit per column of the next
+// row: the columns taken by a queen, and the squares attacked along each
+// diagonal. Moving to the next row shifts the diagonals by one column.
+
+// Count the solutions that fill the remaining rows, given the occupancy of
+// the next row. all has one bit per column.
+static long long searchSerial(unsigned all, unsigned cols, unsigned left,
+                              unsigned right) {
+  if (cols == all) {
+    return 1;
   }
+  long long count = 0;
+  unsigned free = all & ~(cols | left | right);
+  while (free) {
+    unsigned bit = free & -free;
+    free ^= bit;
+    count += searchSerial(all, cols | bit, (left | bit) << 1,
+                          (right | bit) >> 1);
+  }
+  return count;
+}
 
-  return 1;
+// Like searchSerial, but the next depth rows try their columns in parallel.
+// Every solution found counts weight times.
+static void search(int n, unsigned cols, unsigned left, unsigned right,
+                   int depth, int weight, Reducer<op_add<long long>> &solutions) {
+  unsigned all = (1u << n) - 1;
+  if (depth == 0 || cols == all) {
+    *solutions += weight * searchSerial(all, cols, left, right);
+    return;
+  }
+
+  unsigned free = all & ~(cols | left | right);
+  parallel_for(0, n, [=, &solutions](int i) {
+    unsigned bit = 1u << i;
+    if (free & bit) {
+      search(n, cols | bit, (left | bit) << 1, (right | bit) >> 1, depth - 1,
+             weight, solutions);
+    }
+  });
 }
 
-int nqueens(int n, int j, char *a) {
-  if (n == j) {
+long long nqueens(int n, int parallelDepth) {
+  if (n == 0) {
     return 1;
   }
 
-  std::vector<std::future<int>> futures;
-  int solNum = 0;
+  // Mirroring a solution left to right gives another solution, so only
+  // queens in the left half of the first row are searched and counted
+  // twice. With n odd, a queen in the middle column is its own mirror image
+  // and counts once.
+  Reducer<op_add<long long>> solutions;
+  parallel_for(0, (n + 1) / 2, [n, parallelDepth, &solutions](int i) {
+    unsigned bit = 1u << i;
+    int weight = n % 2 == 1 && i == n / 2 ? 1 : 2;
+    search(n, bit, bit << 1, bit >> 1, parallelDepth - 1, weight, solutions);
+  });
+  return solutions.get();
+}
 
-  for (int i = 0; i < n; i++) {
-    char *b = (char *)alloca((j + 1) * sizeof(char));
-    memcpy(b, a, j * sizeof(char));
-    b[j] = i;
+// Shared state of a search for the first solution
+struct FirstSolution {
+  TaskGroup group;
+  // Stop the other searches once a solution is found
+  bool cancel;
+  std::atomic<bool> found = false;
+  std::vector<int> queens;
+};
 
-    if (ok(j + 1, b)) {
-      // Spawn a new task for exploring this partial solution
-      auto fut = scheduler->spawn(
-          [n, j, b]() mutable { return nqueens(n, j + 1, b); });
-      futures.push_back(std::move(fut));
+// Place queens in the remaining rows, queens[r] being the column of row r.
+// Returns false if there is no solution or the search was cancelled.
+static bool firstSerial(int n, int row, unsigned cols, unsigned left,
+                        unsigned right, int *queens) {
+  if (row == n) {
+    return true;
+  }
+  if (TaskGroup::cancelled()) {
+    return false;
+  }
+  unsigned free = ((1u << n) - 1) & ~(cols | left | right);
+  while (free) {
+    unsigned bit = free & -free;
+    free ^= bit;
+    queens[row] = __builtin_ctz(bit);
+    if (firstSerial(n, row + 1, cols | bit, (left | bit) << 1,
+                    (right | bit) >> 1, queens)) {
+      return true;
     }
   }
+  return false;
+}
 
-  for (auto &fut : futures) {
-    solNum += scheduler->sync(std::move(fut));
+// Like firstSerial, but the next depth rows try their columns in parallel.
+// Every parallel branch stops at its first solution.
+static void searchFirst(int n, int row, unsigned cols, unsigned left,
+                        unsigned right, int depth, std::array<int, 32> queens,
+                        FirstSolution &result) {
+  if (depth == 0 || row == n) {
+    if (firstSerial(n, row, cols, left, right, queens.data()) &&
+        !result.found.exchange(true)) {
+      result.queens.assign(queens.begin(), queens.begin() + n);
+      if (result.cancel) {
+        result.group.cancel();
+      }
+    }
+    return;
   }
 
-  return solNum;
-}
\ No newline at end of file
+  unsigned free = ((1u << n) - 1) & ~(cols | left | right);
+  parallel_for(0, n, [=, &result](int i) {
+    unsigned bit = 1u << i;
+    if (free & bit) {
+      std::array<int, 32> next = queens;
+      next[row] = i;
+      searchFirst(n, row + 1, cols | bit, (left | bit) << 1,
+                  (right | bit) >> 1, depth - 1, next, result);
+    }
+  });
+}
+
+bool nqueensFirst(int n, std::vector<int> &queens, bool cancel,
+                  int parallelDepth) {
+  FirstSolution result;
+  result.cancel = cancel;
+  result.group.run([&] {
+    searchFirst(n, 0, 0, 0, 0, parallelDepth, {}, result);
+  });
+  queens = std::move(result.queens);
+  return result.found;
+}
@@ -1 +1,14 @@
-int nqueens(int n, int j, char *a);
\ No newline at end of file
+#include <vector>
+
+// Number of ways to place n queens on an n x n board (n <= 31) so that no
+// two attack each other. The first parallelDepth rows are searched in
+// parallel and the rest serially.
+long long nqueens(int n, int parallelDepth = 3);
+
+// Find one way to place n queens (n <= 31), setting queens[r] to the column
+// of the queen in row r. Returns false if there is none. With cancel, the
+// first solution found stops every other branch of the search. Without it,
+// each of the branches the first parallelDepth rows fork into runs until it
+// finds a solution or exhausts its subtree.
+bool nqueensFirst(int n, std::vector<int> &queens, bool cancel = true,
+                  int parallelDepth = 3);
@@ -5,6 +5,7 @@
 #include <iterator>
 #include <random>
 
+#include "../parallel/parallel_for.hpp"
 #include "../scheduler_instance.hpp"
 #include "pfor.hpp"
 
@@ -69,9 +70,7 @@ int createAndSort() {
 
 // Sort a random array x times
 int pfor(int x) {
-  for (int i = 0; i < x; i++) {
-    scheduler->spawn([] { return createAndSort(); });
-  }
+  parallel_for(0, x, [](int) { createAndSort(); });
 
   return 0;
 }
\ No newline at end of file
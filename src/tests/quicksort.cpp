@@ -1,38 +1,139 @@
 #include "quicksort.hpp"
+#include "../parallel/parallel_partition.hpp"
 #include "../scheduler_instance.hpp"
 
-int seqQuicksort(int *begin, int *end) {
-  if (begin != end) {
-    end--;
-    int pivot = *end;
-    auto middle =
-        std::partition(begin, end, [pivot](int x) { return x < pivot; });
-    std::swap(*end, *middle);
+#include <algorithm>
+#include <utility>
+
+// Ranges larger than this are partitioned in parallel. Below it the serial
+// partition is cheap compared to the parallelism already exposed by the
+// recursion.
+const int PARALLEL_PARTITION_CUTOFF = 1 << 20;
+// Ranges up to this size are sorted serially
+const int SERIAL_CUTOFF = 50000;
+// Ranges up to this size are insertion sorted
+const int INSERTION_SORT_CUTOFF = 16;
+// Ranges larger than this take the pivot as the median of three medians of
+// three (Tukey's ninther) instead of the median of three
+const int NINTHER_CUTOFF = 128;
+
+static void insertionSort(int *begin, int *end) {
+  for (int *i = begin + 1; i < end; i++) {
+    int x = *i;
+    int *j = i;
+    for (; j > begin && x < j[-1]; j--) {
+      *j = j[-1];
+    }
+    *j = x;
+  }
+}
+
+static int median3(int a, int b, int c) {
+  return std::max(std::min(a, b), std::min(std::max(a, b), c));
+}
+
+static int choosePivot(int *begin, int *end) {
+  int n = end - begin;
+  int *mid = begin + n / 2;
+  int *last = end - 1;
+  if (n <= NINTHER_CUTOFF) {
+    return median3(*begin, *mid, *last);
+  }
+  int s = n / 8;
+  return median3(median3(begin[0], begin[s], begin[2 * s]),
+                 median3(mid[-s], mid[0], mid[s]),
+                 median3(last[-2 * s], last[-s], last[0]));
+}
+
+// Dutch national flag partition around pivot. Returns [lt, gt) such that
+// [begin, lt) < pivot, [lt, gt) == pivot and [gt, end) > pivot.
+static std::pair<int *, int *> partition3(int *begin, int *end, int pivot) {
+  int *lt = begin;
+  int *i = begin;
+  int *gt = end;
+  while (i < gt) {
+    if (*i < pivot) {
+      std::swap(*lt++, *i++);
+    } else if (pivot < *i) {
+      std::swap(*i, *--gt);
+    } else {
+      i++;
+    }
+  }
+  return {lt, gt};
+}
+
+// Introsort: falls back to heapsort once depth partitions have failed to
+// make the range small, so the worst case stays O(n log n)
+static void seqQuicksort(int *begin, int *end, int depth) {
+  while (end - begin > INSERTION_SORT_CUTOFF) {
+    if (depth-- == 0) {
+      std::make_heap(begin, end);
+      std::sort_heap(begin, end);
+      return;
+    }
+    auto [lt, gt] = partition3(begin, end, choosePivot(begin, end));
+    // Recurse into the smaller side so the stack stays O(log n)
+    if (lt - begin < end - gt) {
+      seqQuicksort(begin, lt, depth);
+      begin = gt;
+    } else {
+      seqQuicksort(gt, end, depth);
+      end = lt;
+    }
+  }
+  insertionSort(begin, end);
+}
 
-    seqQuicksort(begin, middle);
-    seqQuicksort(++middle, ++end);
+static int depthLimit(int *begin, int *end) {
+  int depth = 0;
+  for (auto n = end - begin; n > 1; n >>= 1) {
+    depth++;
   }
+  return 2 * depth;
+}
 
+int seqQuicksort(int *begin, int *end) {
+  seqQuicksort(begin, end, depthLimit(begin, end));
   return 0;
 }
 
-int quicksort(int *begin, int *end) {
-  if (end - begin <= 50000) {
-    seqQuicksort(begin, end);
+static int quicksort(int *begin, int *end, bool parallelPartition,
+                     int depth) {
+  if (end - begin <= SERIAL_CUTOFF) {
+    seqQuicksort(begin, end, depth);
+    return 0;
+  }
+  if (depth-- == 0) {
+    std::make_heap(begin, end);
+    std::sort_heap(begin, end);
     return 0;
   }
 
-  end--;
-  int pivot = *end;
-  auto middle =
-      std::partition(begin, end, [pivot](int x) { return x < pivot; });
-  std::swap(*end, *middle);
+  int pivot = choosePivot(begin, end);
+  int *lt;
+  int *gt;
+  if (parallelPartition && end - begin > PARALLEL_PARTITION_CUTOFF) {
+    // Two passes: split off the keys less than the pivot, then the keys
+    // equal to it
+    lt = parallel_partition(begin, end, [pivot](int x) { return x < pivot; });
+    gt = parallel_partition(lt, end, [pivot](int x) { return !(pivot < x); });
+  } else {
+    std::tie(lt, gt) = partition3(begin, end, pivot);
+  }
 
-  auto x =
-      scheduler->spawn([begin, middle]() { return quicksort(begin, middle); });
-  quicksort(++middle, ++end);
+  // Keys equal to the pivot are in place, which makes ranges with few
+  // distinct keys shrink quickly
+  auto x = scheduler->spawn([begin, lt, parallelPartition, depth]() {
+    return quicksort(begin, lt, parallelPartition, depth);
+  });
+  quicksort(gt, end, parallelPartition, depth);
 
   scheduler->sync(std::move(x));
 
   return 0;
-}
\ No newline at end of file
+}
+
+int quicksort(int *begin, int *end, bool parallelPartition) {
+  return quicksort(begin, end, parallelPartition, depthLimit(begin, end));
+}
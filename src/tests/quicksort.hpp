@@ -1 +1 @@
-int quicksort(int *begin, int *end);
\ No newline at end of file
+int quicksort(int *begin, int *end, bool parallelPartition = true);
\ No newline at end of file
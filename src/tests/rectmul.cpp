@@ -27,10 +27,27 @@
  */
 
 #include "rectmul.hpp"
+#include "../parallel/reducer.hpp"
 #include "../scheduler_instance.hpp"
+#include "../parallel/parallel_for.hpp"
+#include "rectmul_kernels.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 unsigned long long todval(struct timeval *tp) {
   return tp->tv_sec * 1000 * 1000 + tp->tv_usec;
@@ -41,7 +58,20 @@ unsigned long long todval(struct timeval *tp) {
 
 typedef double DTYPE;
 
-typedef DTYPE block[BLOCK_SIZE];
+// A block of EDGE x EDGE elements of T, row major
+template <typename T, int EDGE> struct Block {
+  typedef T value_type;
+  static constexpr int edge = EDGE;
+  static constexpr int size = EDGE * EDGE;
+
+  T v[size];
+
+  T &operator[](int i) { return v[i]; }
+  const T &operator[](int i) const { return v[i]; }
+};
+
+// The original blocks. The hand written and SIMD kernels only handle these.
+typedef Block<DTYPE, BLOCK_EDGE> block;
 typedef block *pblock;
 
 // apparently register storage specifier is deprecated
@@ -266,24 +296,25 @@ int compare_block(block *R, block *B) {
   return error;
 }
 
-long long add_block(block *T, block *R) {
+template <typename BlockT> long long add_block(BlockT *T, BlockT *R) {
 
   long i;
 
-  for (i = 0; i < BLOCK_SIZE; i += 4) {
-    ((DTYPE *)R)[i] += ((DTYPE *)T)[i];
-    ((DTYPE *)R)[i + 1] += ((DTYPE *)T)[i + 1];
-    ((DTYPE *)R)[i + 2] += ((DTYPE *)T)[i + 2];
-    ((DTYPE *)R)[i + 3] += ((DTYPE *)T)[i + 3];
+  for (i = 0; i < BlockT::size; i += 4) {
+    (*R)[i] += (*T)[i];
+    (*R)[i + 1] += (*T)[i + 1];
+    (*R)[i + 2] += (*T)[i + 2];
+    (*R)[i + 3] += (*T)[i + 3];
   }
 
-  return BLOCK_SIZE;
+  return BlockT::size;
 }
 
 /*
  * Add matrix T into matrix R, where T and R are bl blocks in size
  */
-static long long add_matrix(block *T, long ot, block *R, long orr, long x,
+template <typename BlockT>
+static long long add_matrix(BlockT *T, long ot, BlockT *R, long orr, long x,
                             long y) {
 
   long long flops = 0LL;
@@ -293,8 +324,6 @@ static long long add_matrix(block *T, long ot, block *R, long orr, long x,
     return flops;
   }
 
-  long long _tmp1 = 0LL, _tmp2 = 0LL;
-
   if (x > y) {
     auto future1 = scheduler->spawn(
         [=]() -> long long { return add_matrix(T, ot, R, orr, x / 2, y); });
@@ -311,19 +340,21 @@ static long long add_matrix(block *T, long ot, block *R, long orr, long x,
     flops = _tmp1 + _tmp2;
   }
 
-  flops = _tmp1 + _tmp2;
   return flops;
 }
 
-void init_block(block *R, DTYPE v) {
+template <typename BlockT>
+void init_block(BlockT *R, typename BlockT::value_type v) {
 
   int i;
 
-  for (i = 0; i < BLOCK_SIZE; i++)
-    ((DTYPE *)R)[i] = v;
+  for (i = 0; i < BlockT::size; i++)
+    (*R)[i] = v;
 }
 
-int init_matrix(block *R, long x, long y, long o, DTYPE v) {
+template <typename BlockT>
+int init_matrix(BlockT *R, long x, long y, long o,
+                typename BlockT::value_type v) {
 
   if ((x + y) == 2) {
     init_block(R, v);
@@ -349,49 +380,604 @@ int init_matrix(block *R, long x, long y, long o, DTYPE v) {
   return 0;
 }
 
-static long long multiply_matrix(block *A, long oa, block *B, long ob, long x,
-                                 long y, long z, block *R, long orr, int add) {
+/* Clones of the generic kernel for the wider vector units, picked at load
+ * time by the CPU */
+#if defined(__x86_64__) || defined(__i386__)
+#define GENERIC_KERNEL_CLONES                                                  \
+  __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define GENERIC_KERNEL_CLONES
+#endif
 
-  if ((x + y + z) == 3) {
-    long long _tmp = 0LL;
+/* R = R + AB for blocks of any type and size, left for the compiler to
+ * vectorize
+ */
+template <typename BlockT>
+GENERIC_KERNEL_CLONES static void mult_add_generic(const BlockT *A, const BlockT *B, BlockT *R) {
+  typedef typename BlockT::value_type Elem;
+  const int E = BlockT::edge;
+
+  for (int i = 0; i < E; i++) {
+    Elem *__restrict r = &R->v[i * E];
+    for (int k = 0; k < E; k++) {
+      Elem a = A->v[i * E + k];
+      const Elem *__restrict b = &B->v[k * E];
+      for (int j = 0; j < E; j++)
+        r[j] += a * b[j];
+    }
+  }
+}
+
+bool rectmulKernelSupported(RectmulKernel kernel) {
+  switch (kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+  case KERNEL_AVX2:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  case KERNEL_AVX512:
+    return __builtin_cpu_supports("avx512f");
+#else
+  case KERNEL_AVX2:
+  case KERNEL_AVX512:
+    return false;
+#endif
+  default:
+    return true;
+  }
+}
+
+int rectmulKernelPeakFlopsPerCycle(RectmulKernel kernel) {
+  switch (kernel) {
+  case KERNEL_AVX512:
+    return 2 * 8 * 2;
+  case KERNEL_AVX2:
+    return 2 * 4 * 2;
+  default:
+    // SSE2: a 2 wide multiply and a 2 wide add per cycle
+    return 2 * 2;
+  }
+}
+
+// Checked once at startup
+static const RectmulKernel bestKernel = [] {
+  if (rectmulKernelSupported(KERNEL_AVX512))
+    return KERNEL_AVX512;
+  if (rectmulKernelSupported(KERNEL_AVX2))
+    return KERNEL_AVX2;
+  return KERNEL_PORTABLE;
+}();
+
+// nullptr stands for the original scalar kernels
+static MultAddKernel kernel_function(RectmulKernel kernel) {
+  if (kernel == KERNEL_AUTO)
+    kernel = bestKernel;
+  switch (kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+  case KERNEL_AVX2:
+    return multAddAvx2;
+  case KERNEL_AVX512:
+    return multAddAvx512;
+#endif
+  case KERNEL_PORTABLE:
+    return multAddPortable;
+  default:
+    return nullptr;
+  }
+}
+
+static MultAddFloatKernel float_kernel_function(RectmulKernel kernel) {
+  if (kernel == KERNEL_AUTO)
+    kernel = bestKernel;
+  switch (kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+  case KERNEL_AVX2:
+    return multAddFloatAvx2;
+  case KERNEL_AVX512:
+    return multAddFloatAvx512;
+#endif
+  default:
+    return multAddFloatPortable;
+  }
+}
+
+static const MultAddFloatKernel bestFloatKernel =
+    float_kernel_function(KERNEL_AUTO);
+
+// Temporary block matrices for splitting along y, limited to a budget in
+// bytes. Released matrices stay allocated for reuse, in a free list per
+// worker thread so workers don't contend.
+template <typename BlockT> class TempPool {
+private:
+  static const int SHARDS = 64;
+
+  struct alignas(64) Shard {
+    std::mutex lock;
+    std::vector<std::pair<long, BlockT *>> free;
+  };
+
+  std::atomic<long long> available;
+  std::unique_ptr<Shard[]> shards;
+
+  Shard &shard() {
+    return shards[std::hash<std::thread::id>()(std::this_thread::get_id()) %
+                  SHARDS];
+  }
+
+public:
+  TempPool(long long budget) : available(budget), shards(new Shard[SHARDS]) {}
+
+  ~TempPool() {
+    for (int i = 0; i < SHARDS; i++)
+      for (auto &[blocks, T] : shards[i].free)
+        free(T);
+  }
+
+  // A matrix of the given number of blocks, or nullptr if it doesn't fit in
+  // the budget
+  BlockT *acquire(long blocks) {
+    Shard &own = shard();
+    {
+      std::lock_guard<std::mutex> guard(own.lock);
+      for (auto it = own.free.begin(); it != own.free.end(); ++it) {
+        if (it->first == blocks) {
+          BlockT *T = it->second;
+          own.free.erase(it);
+          return T;
+        }
+      }
+    }
+
+    long long bytes = blocks * sizeof(BlockT);
+    long long left = available.load(std::memory_order_relaxed);
+    do {
+      if (left < bytes)
+        return nullptr;
+    } while (!available.compare_exchange_weak(left, left - bytes,
+                                              std::memory_order_relaxed));
+    return (BlockT *)malloc(bytes);
+  }
+
+  void release(BlockT *T, long blocks) {
+    Shard &own = shard();
+    std::lock_guard<std::mutex> guard(own.lock);
+    own.free.emplace_back(blocks, T);
+  }
+};
+
+template <typename BlockT> struct RectmulContext {
+  // nullptr for the original scalar kernels. Only used for block.
+  MultAddKernel kernel;
+  // Flops are counted in a reducer, since spawned tasks can only hand back
+  // an int
+  Reducer<op_add<long long>> flops;
+  TempPool<BlockT> temps;
+
+  RectmulContext(MultAddKernel kernel, long long tempBudget)
+      : kernel(kernel), temps(tempBudget) {}
+};
+
+// R = AB, or R += AB if add, for single blocks
+template <typename BlockT>
+static void multiply_leaf(BlockT *A, BlockT *B, BlockT *R, int add,
+                          RectmulContext<BlockT> &ctx) {
+  // Flops counted like the scalar kernels below
+  const long long E = BlockT::edge;
+  if constexpr (std::is_same_v<BlockT, Block<float, 16>>) {
+    if (!add)
+      init_block(R, 0);
+    bestFloatKernel(A->v, B->v, R->v);
+    *ctx.flops += add ? 2 * E * E * E : 2 * E * E * E - E * E;
+  } else if constexpr (!std::is_same_v<BlockT, block>) {
+    if (!add)
+      init_block(R, 0);
+    mult_add_generic(A, B, R);
+    *ctx.flops += add ? 2 * E * E * E : 2 * E * E * E - E * E;
+  } else if (ctx.kernel == nullptr) {
     if (add)
-      _tmp = mult_add_block(A, B, R);
+      *ctx.flops += mult_add_block(A, B, R);
     else
-      _tmp = multiply_block(A, B, R);
+      *ctx.flops += multiply_block(A, B, R);
+  } else {
+    // Same flop counts as the scalar kernels
+    if (!add)
+      init_block(R, 0.0);
+    ctx.kernel((DTYPE *)A, (DTYPE *)B, (DTYPE *)R);
+    *ctx.flops += add ? 128 * 64 : 124 * 64;
+  }
+}
 
-    return _tmp;
+template <typename BlockT>
+static void multiply_matrix(BlockT *A, long oa, BlockT *B, long ob, long x,
+                            long y, long z, BlockT *R, long orr, int add,
+                            RectmulContext<BlockT> &ctx) {
+  Reducer<op_add<long long>> &flops = ctx.flops;
+
+  if ((x + y + z) == 3) {
+    multiply_leaf(A, B, R, add, ctx);
+    return;
   }
 
-  long long flops = 0LL;
-  long long _tmp1 = 0LL, _tmp2 = 0LL;
+  if ((x >= y) && (x >= z)) {
+    auto future1 = scheduler->spawn([=, &ctx]() -> int {
+      multiply_matrix(A, oa, B, ob, x / 2, y, z, R, orr, add, ctx);
+      return 0;
+    });
+    multiply_matrix(A + (x / 2) * oa, oa, B, ob, (x + 1) / 2, y, z,
+                    R + (x / 2) * orr, orr, add, ctx);
+    scheduler->sync(std::move(future1));
+  } else if ((y > x) && (y > z)) {
+    // Both halves add into R. If the budget allows, the second half goes to
+    // a temporary instead so they can run in parallel, and is added in
+    // after. Otherwise they run one after the other.
+    BlockT *T = ctx.temps.acquire(x * z);
+    if (T == nullptr) {
+      multiply_matrix(A + (y / 2), oa, B + (y / 2) * ob, ob, x, (y + 1) / 2,
+                      z, R, orr, add, ctx);
+      multiply_matrix(A, oa, B, ob, x, y / 2, z, R, orr, 1, ctx);
+      return;
+    }
+
+    auto future1 = scheduler->spawn([=, &ctx]() -> int {
+      multiply_matrix(A + (y / 2), oa, B + (y / 2) * ob, ob, x, (y + 1) / 2,
+                      z, T, z, 0, ctx);
+      return 0;
+    });
+    multiply_matrix(A, oa, B, ob, x, y / 2, z, R, orr, add, ctx);
+    scheduler->sync(std::move(future1));
+    *flops += add_matrix(T, z, R, orr, x, z);
+    ctx.temps.release(T, x * z);
+  } else {
+    auto future1 = scheduler->spawn([=, &ctx]() -> int {
+      multiply_matrix(A, oa, B, ob, x, y, z / 2, R, orr, add, ctx);
+      return 0;
+    });
+    multiply_matrix(A, oa, B + (z / 2), ob, x, y, (z + 1) / 2, R + (z / 2),
+                    orr, add, ctx);
+    scheduler->sync(std::move(future1));
+  }
+}
+
+/*
+ * Z-order (Morton) block layout. A matrix of rows x cols blocks, both powers
+ * of two, is stored so that halving it along its longer side gives two
+ * contiguous halves, each again in this layout. A square matrix is halved
+ * along its rows first if rowsFirst, along its columns first otherwise.
+ * multiply_matrix always halves the longer side, and on ties the rows of A
+ * and R and the columns of B, so with A and R stored rows first and B
+ * columns first every matrix it recurses into is a contiguous run of
+ * blocks, and nothing but the runs' lengths needs to be passed down.
+ */
+
+static bool split_rows(long rows, long cols, bool rowsFirst) {
+  return rows > cols || (rows == cols && rowsFirst);
+}
+
+static int is_power_of_two(long n) { return n > 0 && (n & (n - 1)) == 0; }
+
+/*
+ * Copy the rows x cols blocks of M (row stride o) to Z in Z-order, or back
+ * from Z to M if toMorton is 0
+ */
+template <typename BlockT>
+static void convert_morton(BlockT *M, long o, long rows, long cols,
+                           int rowsFirst, BlockT *Z, int toMorton) {
+  if (rows * cols == 1) {
+    if (toMorton)
+      memcpy(Z, M, sizeof(BlockT));
+    else
+      memcpy(M, Z, sizeof(BlockT));
+    return;
+  }
+
+  BlockT *Z2 = Z + rows * cols / 2;
+  if (split_rows(rows, cols, rowsFirst)) {
+    auto future1 = scheduler->spawn([=]() -> int {
+      convert_morton(M, o, rows / 2, cols, rowsFirst, Z, toMorton);
+      return 0;
+    });
+    convert_morton(M + (rows / 2) * o, o, rows / 2, cols, rowsFirst, Z2,
+                   toMorton);
+    scheduler->sync(std::move(future1));
+  } else {
+    auto future1 = scheduler->spawn([=]() -> int {
+      convert_morton(M, o, rows, cols / 2, rowsFirst, Z, toMorton);
+      return 0;
+    });
+    convert_morton(M + cols / 2, o, rows, cols / 2, rowsFirst, Z2, toMorton);
+    scheduler->sync(std::move(future1));
+  }
+}
+
+/*
+ * multiply_matrix for A, B and R in Z-order: A and R rows first, B columns
+ * first
+ */
+template <typename BlockT>
+static void multiply_morton(BlockT *A, BlockT *B, BlockT *R, long x, long y,
+                            long z, int add, RectmulContext<BlockT> &ctx) {
+  if ((x + y + z) == 3) {
+    multiply_leaf(A, B, R, add, ctx);
+    return;
+  }
 
   if ((x >= y) && (x >= z)) {
-    auto future1 = scheduler->spawn([=]() -> long long {
-      return multiply_matrix(A, oa, B, ob, x / 2, y, z, R, orr, add);
+    auto future1 = scheduler->spawn([=, &ctx]() -> int {
+      multiply_morton(A, B, R, x / 2, y, z, add, ctx);
+      return 0;
     });
-    long long _tmp2 = multiply_matrix(A + (x / 2) * oa, oa, B, ob, (x + 1) / 2,
-                                      y, z, R + (x / 2) * orr, orr, add);
-    long long _tmp1 = scheduler->sync(std::move(future1));
-    flops = _tmp1 + _tmp2;
+    multiply_morton(A + x * y / 2, B, R + x * z / 2, x / 2, y, z, add, ctx);
+    scheduler->sync(std::move(future1));
   } else if ((y > x) && (y > z)) {
-    long long _tmp1 = multiply_matrix(A + (y / 2) * oa, oa, B + (y / 2) * ob,
-                                      ob, x, (y + 1) / 2, z, R, orr, add);
-    long long _tmp2 = multiply_matrix(A, oa, B, ob, x, y / 2, z, R, orr, add);
-    flops = _tmp1 + _tmp2;
+    BlockT *A2 = A + x * y / 2;
+    BlockT *B2 = B + y * z / 2;
+    BlockT *T = ctx.temps.acquire(x * z);
+    if (T == nullptr) {
+      multiply_morton(A2, B2, R, x, y / 2, z, add, ctx);
+      multiply_morton(A, B, R, x, y / 2, z, 1, ctx);
+      return;
+    }
+
+    auto future1 = scheduler->spawn([=, &ctx]() -> int {
+      multiply_morton(A2, B2, T, x, y / 2, z, 0, ctx);
+      return 0;
+    });
+    multiply_morton(A, B, R, x, y / 2, z, add, ctx);
+    scheduler->sync(std::move(future1));
+    // T and R have the same layout, so they add as one row of blocks
+    *ctx.flops += add_matrix(T, x * z, R, x * z, 1, x * z);
+    ctx.temps.release(T, x * z);
   } else {
-    auto future1 = scheduler->spawn([=]() -> long long {
-      return multiply_matrix(A, oa, B, ob, x, y, z / 2, R, orr, add);
+    auto future1 = scheduler->spawn([=, &ctx]() -> int {
+      multiply_morton(A, B, R, x, y, z / 2, add, ctx);
+      return 0;
     });
-    long long _tmp2 = multiply_matrix(A, oa, B + (z / 2) * ob, ob, x, y,
-                                      (z + 1) / 2, R + (z / 2) * orr, orr, add);
-    long long _tmp1 = scheduler->sync(std::move(future1));
-    flops = _tmp1 + _tmp2;
+    multiply_morton(A, B + y * z / 2, R + x * z / 2, x, y, z / 2, add, ctx);
+    scheduler->sync(std::move(future1));
   }
+}
 
-  return flops;
+/*
+ * Strassen-Winograd for square matrices of n x n blocks, n a power of two,
+ * in Z-order: 7 half size products and 15 half size additions instead of 8
+ * products. Below the crossover size the classical multiply_morton takes
+ * over. In Z-order the quadrants of a matrix are contiguous, A's and R's in
+ * the order 11, 12, 21, 22 and B's in the order 11, 21, 12, 22, and each
+ * quadrant is in the same layout as its matrix.
+ */
+
+/*
+ * Per worker bump allocator for Strassen's temporaries. A task releases what
+ * it took before it finishes, and a worker only runs other tasks nested
+ * inside its own (while syncing), so every worker allocates and frees in
+ * stack order. Memory is kept for reuse until the worker exits.
+ */
+class ScratchArena {
+private:
+  static constexpr long MIN_CHUNK = 1 << 21;
+
+  struct Chunk {
+    char *base;
+    long size;
+  };
+  std::vector<Chunk> chunks;
+  size_t current = 0;
+  long used = 0;
+
+public:
+  struct Mark {
+    size_t chunk;
+    long used;
+  };
+
+  ~ScratchArena() {
+    for (auto &chunk : chunks)
+      free(chunk.base);
+  }
+
+  Mark mark() const { return {current, used}; }
+
+  // Free everything allocated since m
+  void release(Mark m) {
+    current = m.chunk;
+    used = m.used;
+  }
+
+  template <typename BlockT> BlockT *alloc(long blocks) {
+    long bytes = blocks * sizeof(BlockT);
+    while (current < chunks.size() && chunks[current].size - used < bytes) {
+      current++;
+      used = 0;
+    }
+    if (current == chunks.size()) {
+      long size = std::max(bytes, MIN_CHUNK);
+      chunks.push_back({(char *)malloc(size), size});
+    }
+    BlockT *p = (BlockT *)(chunks[current].base + used);
+    used += bytes;
+    return p;
+  }
+};
+
+static thread_local ScratchArena scratch;
+
+template <typename BlockT>
+static void strassen(BlockT *A, BlockT *B, BlockT *R, long n, long crossover,
+                     RectmulContext<BlockT> &ctx) {
+  typedef typename BlockT::value_type Elem;
+  if (n <= crossover || n == 1) {
+    multiply_morton(A, B, R, n, n, n, 0, ctx);
+    return;
+  }
+
+  long q = n * n / 4;
+  BlockT *A11 = A, *A12 = A + q, *A21 = A + 2 * q, *A22 = A + 3 * q;
+  BlockT *B11 = B, *B21 = B + q, *B12 = B + 2 * q, *B22 = B + 3 * q;
+
+  ScratchArena::Mark mark = scratch.mark();
+  BlockT *S = scratch.alloc<BlockT>(4 * q);
+  BlockT *T = scratch.alloc<BlockT>(4 * q);
+  BlockT *M = scratch.alloc<BlockT>(7 * q);
+
+  // S1 = A21 + A22, S2 = S1 - A11, S3 = A11 - A21, S4 = A12 - S2
+  // T1 = B12 - B11, T2 = B22 - T1, T3 = B22 - B12, T4 = T2 - B21
+  parallel_for(0L, q, [=](long b) {
+    for (int i = 0; i < BlockT::size; i++) {
+      Elem a11 = A11[b][i], a12 = A12[b][i], a21 = A21[b][i],
+            a22 = A22[b][i];
+      Elem s1 = a21 + a22, s2 = s1 - a11;
+      S[b][i] = s1;
+      S[q + b][i] = s2;
+      S[2 * q + b][i] = a11 - a21;
+      S[3 * q + b][i] = a12 - s2;
+
+      Elem b11 = B11[b][i], b12 = B12[b][i], b21 = B21[b][i],
+            b22 = B22[b][i];
+      Elem t1 = b12 - b11, t2 = b22 - t1;
+      T[b][i] = t1;
+      T[q + b][i] = t2;
+      T[2 * q + b][i] = b22 - b12;
+      T[3 * q + b][i] = t2 - b21;
+    }
+  });
+
+  // M1 = A11 B11, M2 = A12 B21, M3 = S4 B22, M4 = A22 T4, M5 = S1 T1,
+  // M6 = S2 T2, M7 = S3 T3
+  BlockT *left[7] = {A11, A12, S + 3 * q, A22, S, S + q, S + 2 * q};
+  BlockT *right[7] = {B11, B21, B22, T + 3 * q, T, T + q, T + 2 * q};
+  std::vector<std::future<int>> products;
+  for (int m = 0; m < 6; m++) {
+    products.push_back(scheduler->spawn([=, &ctx]() -> int {
+      strassen(left[m], right[m], M + m * q, n / 2, crossover, ctx);
+      return 0;
+    }));
+  }
+  strassen(left[6], right[6], M + 6 * q, n / 2, crossover, ctx);
+  for (auto &product : products)
+    scheduler->sync(std::move(product));
+
+  // R11 = M1 + M2, U2 = M1 + M6, U3 = U2 + M7, U4 = U2 + M5,
+  // R12 = U4 + M3, R21 = U3 - M4, R22 = U3 + M5
+  parallel_for(0L, q, [=](long b) {
+    for (int i = 0; i < BlockT::size; i++) {
+      Elem m1 = M[b][i], m5 = M[4 * q + b][i];
+      Elem u2 = m1 + M[5 * q + b][i];
+      Elem u3 = u2 + M[6 * q + b][i];
+      R[b][i] = m1 + M[q + b][i];
+      R[q + b][i] = u2 + m5 + M[2 * q + b][i];
+      R[2 * q + b][i] = u3 - M[3 * q + b][i];
+      R[3 * q + b][i] = u3 + m5;
+    }
+  });
+  *ctx.flops += 15 * q * BlockT::size;
+
+  scratch.release(mark);
 }
 
-int rectmul(long x, long y, long z) {
+// Fill the n x n block matrices A and B with random values in [-1, 1]
+static void random_fill(block *A, block *B, long n) {
+  std::mt19937 gen(n);
+  std::uniform_real_distribution<DTYPE> dist(-1.0, 1.0);
+  for (long b = 0; b < n * n; b++) {
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+      A[b][i] = dist(gen);
+      B[b][i] = dist(gen);
+    }
+  }
+}
+
+double rectmulStrassenError(long n, long crossover, RectmulKernel kernel) {
+  block *A = (block *)malloc(n * n * sizeof(block));
+  block *B = (block *)malloc(n * n * sizeof(block));
+  block *R = (block *)malloc(n * n * sizeof(block));
+  block *C = (block *)malloc(n * n * sizeof(block));
+  random_fill(A, B, n);
+
+  RectmulContext<block> ctx(kernel_function(kernel), 0);
+  multiply_morton(A, B, C, n, n, n, 0, ctx);
+  strassen(A, B, R, n, crossover, ctx);
+
+  // Entries of A and B are at most 1, so every entry of AB is a sum of at
+  // most 16n terms of size at most 1
+  double error = 0.0;
+  for (long b = 0; b < n * n; b++)
+    for (int i = 0; i < BLOCK_SIZE; i++)
+      error = std::max(error, (double)std::fabs(R[b][i] - C[b][i]));
+
+  free(A);
+  free(B);
+  free(R);
+  free(C);
+  return error / (16.0 * n);
+}
+
+long rectmulTuneCrossover(long n, RectmulKernel kernel) {
+  block *A = (block *)malloc(n * n * sizeof(block));
+  block *B = (block *)malloc(n * n * sizeof(block));
+  block *R = (block *)malloc(n * n * sizeof(block));
+  random_fill(A, B, n);
+
+  // Halve the crossover, starting from n (no Strassen level at all), for as
+  // long as that makes the product faster
+  RectmulContext<block> ctx(kernel_function(kernel), 0);
+  long best = n;
+  double bestTime = 0.0;
+  for (long crossover = n; crossover >= 1; crossover /= 2) {
+    auto start = std::chrono::steady_clock::now();
+    strassen(A, B, R, n, crossover, ctx);
+    double time = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    if (crossover != n && time >= bestTime)
+      break;
+    best = crossover;
+    bestTime = time;
+  }
+
+  free(A);
+  free(B);
+  free(R);
+  return best;
+}
+
+/*
+ * R = AB for an x by y block matrix A and a y by z one, both row major. The
+ * Z-order layout and Strassen-Winograd only apply where the block counts
+ * allow them.
+ */
+template <typename BlockT>
+static void multiply_blocks(BlockT *A, BlockT *B, BlockT *R, long x, long y,
+                            long z, RectmulContext<BlockT> &ctx,
+                            RectmulLayout layout, long strassenCrossover) {
+  int square = x == y && y == z;
+  int strassenFits = strassenCrossover > 0 && square && is_power_of_two(x);
+  if (strassenFits || (layout == LAYOUT_MORTON && is_power_of_two(x) &&
+                       is_power_of_two(y) && is_power_of_two(z))) {
+    BlockT *ZA = (BlockT *)malloc(x * y * sizeof(BlockT));
+    BlockT *ZB = (BlockT *)malloc(y * z * sizeof(BlockT));
+    BlockT *ZR = (BlockT *)malloc(x * z * sizeof(BlockT));
+    auto convertA = scheduler->spawn([=]() -> int {
+      convert_morton(A, y, x, y, 1, ZA, 1);
+      return 0;
+    });
+    convert_morton(B, z, y, z, 0, ZB, 1);
+    scheduler->sync(std::move(convertA));
+
+    if (strassenFits)
+      strassen(ZA, ZB, ZR, x, strassenCrossover, ctx);
+    else
+      multiply_morton(ZA, ZB, ZR, x, y, z, 0, ctx);
+    convert_morton(R, z, x, z, 1, ZR, 0);
+
+    free(ZA);
+    free(ZB);
+    free(ZR);
+  } else {
+    multiply_matrix(A, y, B, z, x, y, z, R, z, 0, ctx);
+  }
+}
+
+int rectmul(long x, long y, long z, RectmulKernel kernel,
+            long long tempBudget, RectmulLayout layout,
+            long strassenCrossover) {
 
   block *A, *B, *R;
   long long flops;
@@ -408,11 +994,86 @@ int rectmul(long x, long y, long z) {
   scheduler->sync(std::move(initA)); // Wait for task to complete
   scheduler->sync(std::move(initB)); // Wait for task to complete
 
-  flops = multiply_matrix(A, y, B, z, x, y, z, R, z, 0);
+  RectmulContext<block> ctx(kernel_function(kernel), tempBudget);
+  multiply_blocks(A, B, R, x, y, z, ctx, layout, strassenCrossover);
+  flops = ctx.flops.get();
 
   free(A);
   free(B);
   free(R);
 
   return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Element (i, j) of a block matrix with row stride o (in blocks)
+ */
+template <typename BlockT>
+static typename BlockT::value_type &element(BlockT *M, long o, long i,
+                                            long j) {
+  const int E = BlockT::edge;
+  return M[(i / E) * o + j / E][(i % E) * E + j % E];
+}
+
+/*
+ * Fill the rows x cols matrix stored in the x by y blocks of M with v, and
+ * the padding that rounds it up to whole blocks with 0
+ */
+template <typename BlockT>
+static void init_padded(BlockT *M, long x, long y, long rows, long cols,
+                        typename BlockT::value_type v) {
+  const int E = BlockT::edge;
+  init_matrix(M, x, y, y, v);
+  // Only the last row and column of blocks hold padding
+  for (long i = 0; i < x * E; i++)
+    for (long j = i < rows ? cols : 0; j < y * E; j++)
+      element(M, y, i, j) = 0;
+}
+
+template <typename T, int EDGE>
+int rectmulTyped(long rows, long inner, long cols, long long tempBudget,
+                 RectmulLayout layout) {
+  typedef Block<T, EDGE> BlockT;
+
+  // Zero padding up to whole blocks leaves the product unchanged
+  long x = (rows + EDGE - 1) / EDGE;
+  long y = (inner + EDGE - 1) / EDGE;
+  long z = (cols + EDGE - 1) / EDGE;
+  BlockT *A = (BlockT *)malloc(x * y * sizeof(BlockT));
+  BlockT *B = (BlockT *)malloc(y * z * sizeof(BlockT));
+  BlockT *R = (BlockT *)malloc(x * z * sizeof(BlockT));
+
+  auto initA = scheduler->spawn([=]() -> int {
+    init_padded(A, x, y, rows, inner, 1);
+    return 0;
+  });
+  init_padded(B, y, z, inner, cols, 1);
+  scheduler->sync(std::move(initA));
+
+  RectmulContext<BlockT> ctx(kernel_function(KERNEL_AUTO), tempBudget);
+  multiply_blocks(A, B, R, x, y, z, ctx, layout, 0);
+
+  // A and B are all ones, so every entry of the product is inner
+  int errors = 0;
+  for (long i = 0; i < rows; i++)
+    for (long j = 0; j < cols; j++)
+      if (element(R, z, i, j) != (T)inner)
+        errors++;
+
+  free(A);
+  free(B);
+  free(R);
+
+  return errors;
+}
+
+template int rectmulTyped<double, 16>(long, long, long, long long,
+                                      RectmulLayout);
+template int rectmulTyped<double, 8>(long, long, long, long long,
+                                     RectmulLayout);
+template int rectmulTyped<float, 16>(long, long, long, long long,
+                                     RectmulLayout);
+template int rectmulTyped<float, 32>(long, long, long, long long,
+                                     RectmulLayout);
+template int rectmulTyped<int32_t, 16>(long, long, long, long long,
+                                       RectmulLayout);
@@ -1 +1,58 @@
-int rectmul(long x, long y, long z);
\ No newline at end of file
+#include <cstdint>
+
+// Kernel multiplying two 16 x 16 blocks
+enum RectmulKernel {
+  // The fastest kernel the CPU supports, picked at startup
+  KERNEL_AUTO,
+  // The original scalar kernel with 2 x 2 register blocking
+  KERNEL_SCALAR,
+  // Portable C++ with 4 x 4 register tiles
+  KERNEL_PORTABLE,
+  KERNEL_AVX2,
+  KERNEL_AVX512,
+};
+
+// Whether this CPU can run kernel
+bool rectmulKernelSupported(RectmulKernel kernel);
+
+// Double precision flops per cycle a core can retire with kernel's
+// instructions at best, assuming two vector (FMA) pipes
+int rectmulKernelPeakFlopsPerCycle(RectmulKernel kernel);
+
+// How rectmul stores its block matrices while multiplying
+enum RectmulLayout {
+  // Rows of blocks one after the other
+  LAYOUT_ROW_MAJOR,
+  // Z-order, so every quadrant the recursion visits is contiguous. Needs
+  // power of two block counts, other shapes stay row major.
+  LAYOUT_MORTON,
+};
+
+// Multiply an x by y block matrix with a y by z one. Where y is split, the
+// two halves run in parallel if a temporary for one of them fits in
+// tempBudget bytes, and one after the other otherwise. Square products of
+// power of two size use Strassen-Winograd down to strassenCrossover blocks
+// per side if that is not 0.
+int rectmul(long x, long y, long z, RectmulKernel kernel = KERNEL_AUTO,
+            long long tempBudget = 0, RectmulLayout layout = LAYOUT_ROW_MAJOR,
+            long strassenCrossover = 0);
+
+// Largest difference between Strassen-Winograd and the classical product of
+// random n x n block matrices with entries in [-1, 1], relative to the
+// largest possible entry of the product
+double rectmulStrassenError(long n, long crossover,
+                            RectmulKernel kernel = KERNEL_AUTO);
+
+// The crossover that makes Strassen-Winograd fastest on n x n block
+// matrices. Returns n if the classical product is fastest.
+long rectmulTuneCrossover(long n, RectmulKernel kernel = KERNEL_AUTO);
+
+// Multiply a rows x inner matrix of ones with an inner x cols one, stored in
+// EDGE x EDGE blocks of T. Shapes that aren't whole blocks are padded with
+// zeros. Uses the generic block kernel, except for double and EDGE 16,
+// which get the fastest kernel the CPU supports. Returns the number of wrong
+// entries in the product. Instantiated for double with EDGE 8 and 16, float
+// with 16 and 32, and int32_t with 16.
+template <typename T, int EDGE>
+int rectmulTyped(long rows, long inner, long cols, long long tempBudget = 0,
+                 RectmulLayout layout = LAYOUT_ROW_MAJOR);
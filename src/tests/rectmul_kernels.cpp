@@ -0,0 +1,196 @@
+/*
+ * Vectorized micro-kernels for rectmul's 16 x 16 blocks of doubles and of
+ * floats. Every kernel first packs A transposed, so walking down a column of
+ * A (one broadcast per row of the register tile) reads consecutive elements. Rows of B are already
+ * contiguous. A register tile of R stays in registers for all 16 steps of k.
+ *
+ * The loops over a tile are fully unrolled, so the accumulators can live in
+ * registers at -O2 as well.
+ *
+ * The SIMD kernels are compiled with target attributes, so the rest of the
+ * program doesn't need -mavx2 and runs on any x86 CPU. rectmul only calls
+ * them after checking CPUID.
+ */
+
+#include "rectmul_kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define EDGE 16
+
+// At[k * EDGE + i] = A[i * EDGE + k]
+template <typename T> static void pack_transposed(const T *A, T *At) {
+  for (int i = 0; i < EDGE; i++)
+    for (int k = 0; k < EDGE; k++)
+      At[k * EDGE + i] = A[i * EDGE + k];
+}
+
+template <typename T> static void mult_add_tiled(const T *A, const T *B, T *R) {
+  alignas(64) T At[EDGE * EDGE];
+  pack_transposed(A, At);
+
+  for (int i = 0; i < EDGE; i += 4) {
+    for (int j = 0; j < EDGE; j += 4) {
+      T c[4][4];
+      #pragma GCC unroll 8
+      for (int r = 0; r < 4; r++)
+        #pragma GCC unroll 8
+        for (int s = 0; s < 4; s++)
+          c[r][s] = R[(i + r) * EDGE + j + s];
+
+      for (int k = 0; k < EDGE; k++) {
+        const T *a = &At[k * EDGE + i];
+        const T *b = &B[k * EDGE + j];
+        #pragma GCC unroll 8
+        for (int r = 0; r < 4; r++)
+          #pragma GCC unroll 8
+          for (int s = 0; s < 4; s++)
+            c[r][s] += a[r] * b[s];
+      }
+
+      #pragma GCC unroll 8
+      for (int r = 0; r < 4; r++)
+        #pragma GCC unroll 8
+        for (int s = 0; s < 4; s++)
+          R[(i + r) * EDGE + j + s] = c[r][s];
+    }
+  }
+}
+
+void multAddPortable(const double *A, const double *B, double *R) {
+  mult_add_tiled(A, B, R);
+}
+
+void multAddFloatPortable(const float *A, const float *B, float *R) {
+  mult_add_tiled(A, B, R);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,fma"))) void
+multAddAvx2(const double *A, const double *B, double *R) {
+  alignas(64) double At[EDGE * EDGE];
+  pack_transposed(A, At);
+
+  for (int i = 0; i < EDGE; i += 4) {
+    for (int j = 0; j < EDGE; j += 8) {
+      __m256d c[4][2];
+      #pragma GCC unroll 8
+      for (int r = 0; r < 4; r++) {
+        c[r][0] = _mm256_loadu_pd(&R[(i + r) * EDGE + j]);
+        c[r][1] = _mm256_loadu_pd(&R[(i + r) * EDGE + j + 4]);
+      }
+
+      for (int k = 0; k < EDGE; k++) {
+        __m256d b0 = _mm256_loadu_pd(&B[k * EDGE + j]);
+        __m256d b1 = _mm256_loadu_pd(&B[k * EDGE + j + 4]);
+        #pragma GCC unroll 8
+        for (int r = 0; r < 4; r++) {
+          __m256d a = _mm256_broadcast_sd(&At[k * EDGE + i + r]);
+          c[r][0] = _mm256_fmadd_pd(a, b0, c[r][0]);
+          c[r][1] = _mm256_fmadd_pd(a, b1, c[r][1]);
+        }
+      }
+
+      #pragma GCC unroll 8
+      for (int r = 0; r < 4; r++) {
+        _mm256_storeu_pd(&R[(i + r) * EDGE + j], c[r][0]);
+        _mm256_storeu_pd(&R[(i + r) * EDGE + j + 4], c[r][1]);
+      }
+    }
+  }
+}
+
+__attribute__((target("avx512f"))) void
+multAddAvx512(const double *A, const double *B, double *R) {
+  alignas(64) double At[EDGE * EDGE];
+  pack_transposed(A, At);
+
+  for (int i = 0; i < EDGE; i += 8) {
+    __m512d c[8][2];
+    #pragma GCC unroll 8
+    for (int r = 0; r < 8; r++) {
+      c[r][0] = _mm512_loadu_pd(&R[(i + r) * EDGE]);
+      c[r][1] = _mm512_loadu_pd(&R[(i + r) * EDGE + 8]);
+    }
+
+    for (int k = 0; k < EDGE; k++) {
+      __m512d b0 = _mm512_loadu_pd(&B[k * EDGE]);
+      __m512d b1 = _mm512_loadu_pd(&B[k * EDGE + 8]);
+      #pragma GCC unroll 8
+      for (int r = 0; r < 8; r++) {
+        __m512d a = _mm512_set1_pd(At[k * EDGE + i + r]);
+        c[r][0] = _mm512_fmadd_pd(a, b0, c[r][0]);
+        c[r][1] = _mm512_fmadd_pd(a, b1, c[r][1]);
+      }
+    }
+
+    #pragma GCC unroll 8
+    for (int r = 0; r < 8; r++) {
+      _mm512_storeu_pd(&R[(i + r) * EDGE], c[r][0]);
+      _mm512_storeu_pd(&R[(i + r) * EDGE + 8], c[r][1]);
+    }
+  }
+}
+
+// A row of floats is two ymm registers, so tiles are 4 x 16
+__attribute__((target("avx2,fma"))) void
+multAddFloatAvx2(const float *A, const float *B, float *R) {
+  alignas(64) float At[EDGE * EDGE];
+  pack_transposed(A, At);
+
+  for (int i = 0; i < EDGE; i += 4) {
+    __m256 c[4][2];
+    #pragma GCC unroll 8
+    for (int r = 0; r < 4; r++) {
+      c[r][0] = _mm256_loadu_ps(&R[(i + r) * EDGE]);
+      c[r][1] = _mm256_loadu_ps(&R[(i + r) * EDGE + 8]);
+    }
+
+    for (int k = 0; k < EDGE; k++) {
+      __m256 b0 = _mm256_loadu_ps(&B[k * EDGE]);
+      __m256 b1 = _mm256_loadu_ps(&B[k * EDGE + 8]);
+      #pragma GCC unroll 8
+      for (int r = 0; r < 4; r++) {
+        __m256 a = _mm256_broadcast_ss(&At[k * EDGE + i + r]);
+        c[r][0] = _mm256_fmadd_ps(a, b0, c[r][0]);
+        c[r][1] = _mm256_fmadd_ps(a, b1, c[r][1]);
+      }
+    }
+
+    #pragma GCC unroll 8
+    for (int r = 0; r < 4; r++) {
+      _mm256_storeu_ps(&R[(i + r) * EDGE], c[r][0]);
+      _mm256_storeu_ps(&R[(i + r) * EDGE + 8], c[r][1]);
+    }
+  }
+}
+
+// A row of floats is one zmm register, so the whole block is one tile
+__attribute__((target("avx512f"))) void
+multAddFloatAvx512(const float *A, const float *B, float *R) {
+  alignas(64) float At[EDGE * EDGE];
+  pack_transposed(A, At);
+
+  __m512 c[EDGE];
+  #pragma GCC unroll 16
+  for (int r = 0; r < EDGE; r++)
+    c[r] = _mm512_loadu_ps(&R[r * EDGE]);
+
+  for (int k = 0; k < EDGE; k++) {
+    __m512 b = _mm512_loadu_ps(&B[k * EDGE]);
+    #pragma GCC unroll 16
+    for (int r = 0; r < EDGE; r++) {
+      __m512 a = _mm512_set1_ps(At[k * EDGE + r]);
+      c[r] = _mm512_fmadd_ps(a, b, c[r]);
+    }
+  }
+
+  #pragma GCC unroll 16
+  for (int r = 0; r < EDGE; r++)
+    _mm512_storeu_ps(&R[r * EDGE], c[r]);
+}
+
+#endif
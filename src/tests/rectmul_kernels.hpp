@@ -0,0 +1,31 @@
+#ifndef RECTMUL_KERNELS_HPP
+#define RECTMUL_KERNELS_HPP
+
+// R = R + AB for 16 x 16 row major blocks of doubles
+typedef void (*MultAddKernel)(const double *A, const double *B, double *R);
+
+// Plain C++ with 4 x 4 register tiles, runs anywhere
+void multAddPortable(const double *A, const double *B, double *R);
+
+#if defined(__x86_64__) || defined(__i386__)
+// 4 x 8 tiles in 8 ymm accumulators. Needs AVX2 and FMA.
+void multAddAvx2(const double *A, const double *B, double *R);
+
+// 8 x 16 tiles in 16 zmm accumulators. Needs AVX-512F.
+void multAddAvx512(const double *A, const double *B, double *R);
+#endif
+
+// The same for 16 x 16 blocks of floats
+typedef void (*MultAddFloatKernel)(const float *A, const float *B, float *R);
+
+void multAddFloatPortable(const float *A, const float *B, float *R);
+
+#if defined(__x86_64__) || defined(__i386__)
+// 4 x 16 tiles in 8 ymm accumulators. Needs AVX2 and FMA.
+void multAddFloatAvx2(const float *A, const float *B, float *R);
+
+// The whole block in 16 zmm accumulators. Needs AVX-512F.
+void multAddFloatAvx512(const float *A, const float *B, float *R);
+#endif
+
+#endif